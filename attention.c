@@ -1,12 +1,16 @@
 #include "attention.h"
+#include "kernels.h"
+#include "threads.h"
+#include <stdatomic.h>
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 // Function to create a single attention head
 Head* create_head(int n_embd, int head_size) {
     Head* head = (Head*)malloc(sizeof(Head));
-    head->key = create_linear_layer(n_embd, head_size);
     head->query = create_linear_layer(n_embd, head_size);
-    head->value = create_linear_layer(n_embd, head_size);
 
     int tril_shape[] = {1, 1, 1}; // Placeholder shape
     head->tril = create_tensor(tril_shape, 3);
@@ -17,48 +21,105 @@ Head* create_head(int n_embd, int head_size) {
 
 // Function to free a single attention head
 void free_head(Head* head) {
-    free_linear_layer(head->key);
     free_linear_layer(head->query);
-    free_linear_layer(head->value);
     free_tensor(head->tril);
     free(head);
 }
 
-// Forward pass for a single attention head
-Tensor* head_forward(Head* head, const Tensor* x) {
-    Tensor* k = linear_forward(head->key, x);
-    Tensor* q = linear_forward(head->query, x);
+// Forward pass for the query heads of one key/value group
+// x is [..., T, n_embd] and k, v are the group's [..., T, head_size] keys and values;
+// every leading index is a separate sequence. The heads' queries are stacked per
+// sequence, head-major, into one [..., group_size * T, head_size] operand as in the
+// cached path, so the scores and the weighted values are one batched GEMM each for
+// the whole group. Returns the outputs stacked the same way, or NULL on error.
+Tensor* head_group_forward(Head** heads, int group_size, const Tensor* x, const Tensor* k, const Tensor* v) {
+    int n_dims = k->n_dims;
+    int T = k->shape[n_dims - 2];
+    size_t block = (size_t)T * k->shape[n_dims - 1];
+    int n_seqs = block > 0 ? (int)(k->size / block) : 0;
 
-    Tensor* k_transposed = transpose(k);
-    Tensor* wei = matmul(q, k_transposed);
-    free_tensor(k_transposed);
+    int shape[n_dims];
+    memcpy(shape, k->shape, n_dims * sizeof(int));
+    shape[n_dims - 2] = group_size * T;
+    Tensor* q = create_tensor(shape, n_dims);
+    Tensor* q_head = create_tensor(k->shape, n_dims);
+    shape[n_dims - 1] = T;
+    Tensor* wei = create_tensor(shape, n_dims);
 
-    scale(wei, 1.0f / sqrtf(k->shape[1]));
+    // Head r of sequence s is block s * group_size + r of q
+    int ok = 1;
+    for (int r = 0; ok && r < group_size; ++r) {
+        ok = linear_forward_into(heads[r]->query, x, q_head) == 0;
+        for (int s = 0; ok && s < n_seqs; ++s) {
+            memcpy(q->data + ((size_t)s * group_size + r) * block, q_head->data + (size_t)s * block,
+                   block * sizeof(float));
+        }
+    }
+
+    // wei[..., r * T + i, j] = q[..., r * T + i, :] . k[..., j, :], without materializing k^T
+    Tensor* out = NULL;
+    if (ok && bmm_transposed_into(wei, q, k) == 0) {
+        scale_(wei, 1.0f / sqrtf(k->shape[n_dims - 1]));
 
-    // Masking is not fully implemented here, but this is where it would be applied
-    // wei = masked_fill(wei, head->tril == 0, -INFINITY);
+        // Causal mask: position i only attends to positions <= i, in every head's block
+        for (int r = 0; r < wei->size / T; ++r) {
+            int i = r % T;
+            for (int j = i + 1; j < T; ++j) {
+                wei->data[(size_t)r * T + j] = -INFINITY;
+            }
+        }
 
-    softmax(wei, wei->n_dims - 1);
+        softmax(wei, n_dims - 1);
 
-    Tensor* v = linear_forward(head->value, x);
-    Tensor* out = matmul(wei, v);
+        out = bmm(wei, v);
+    }
 
-    free_tensor(k);
     free_tensor(q);
-    free_tensor(v);
+    free_tensor(q_head);
     free_tensor(wei);
-
     return out;
 }
 
-// Function to create a multi-head attention module
-MultiHeadAttention* create_multi_head_attention(int n_embd, int n_heads) {
+// Function to record the query heads of one key/value group into a graph
+// The group's queries are stacked as in head_group_forward, so the scores and the
+// weighted values are one batched product each; the scale, causal mask and softmax
+// of the scores fuse into one pass. The output node stacks the heads the same way.
+int head_group_record(Head** heads, int group_size, Graph* g, int x, int k, int v) {
+    int queries[group_size];
+    for (int r = 0; r < group_size; ++r) {
+        queries[r] = graph_linear(g, heads[r]->query, x);
+    }
+    int q = group_size > 1 ? graph_stack(g, queries, group_size) : queries[0];
+    int wei = graph_bmm_nt(g, q, k);
+    int head_size = heads[0]->query->weights->shape[1];
+    wei = graph_softmax(g, graph_causal_mask(g, graph_scale(g, wei, 1.0f / sqrtf(head_size))));
+    return graph_bmm(g, wei, v);
+}
+
+// Function to create a multi-head attention module with n_kv_heads key/value heads
+MultiHeadAttention* create_multi_head_attention(int n_embd, int n_heads, int n_kv_heads) {
+    if (n_kv_heads <= 0 || n_kv_heads > n_heads || n_heads % n_kv_heads != 0) {
+        fprintf(stderr, "Error: %d attention heads cannot be split into %d key/value groups.\n", n_heads, n_kv_heads);
+        return NULL;
+    }
     MultiHeadAttention* mha = (MultiHeadAttention*)malloc(sizeof(MultiHeadAttention));
     mha->n_heads = n_heads;
+    mha->n_kv_heads = n_kv_heads;
     mha->heads = (Head**)malloc(n_heads * sizeof(Head*));
+    mha->keys = (Linear**)malloc(n_kv_heads * sizeof(Linear*));
+    mha->values = (Linear**)malloc(n_kv_heads * sizeof(Linear*));
     int head_size = n_embd / n_heads;
+    int group_size = n_heads / n_kv_heads;
+    // Key, query, value order, so with n_kv_heads == n_heads the weights are drawn
+    // exactly as for independent heads
     for (int i = 0; i < n_heads; ++i) {
+        if (i % group_size == 0) {
+            mha->keys[i / group_size] = create_linear_layer(n_embd, head_size);
+        }
         mha->heads[i] = create_head(n_embd, head_size);
+        if (i % group_size == 0) {
+            mha->values[i / group_size] = create_linear_layer(n_embd, head_size);
+        }
     }
     mha->proj = create_linear_layer(n_embd, n_embd);
     return mha;
@@ -69,22 +130,58 @@ void free_multi_head_attention(MultiHeadAttention* mha) {
     for (int i = 0; i < mha->n_heads; ++i) {
         free_head(mha->heads[i]);
     }
+    for (int i = 0; i < mha->n_kv_heads; ++i) {
+        free_linear_layer(mha->keys[i]);
+        free_linear_layer(mha->values[i]);
+    }
     free(mha->heads);
+    free(mha->keys);
+    free(mha->values);
     free_linear_layer(mha->proj);
     free(mha);
 }
 
 // Forward pass for multi-head attention
+// Keys and values are projected once per group and shared by its query heads.
 Tensor* multi_head_attention_forward(MultiHeadAttention* mha, const Tensor* x) {
-    Tensor* head_outputs[mha->n_heads];
-    for (int i = 0; i < mha->n_heads; ++i) {
-        head_outputs[i] = head_forward(mha->heads[i], x);
+    int group_size = mha->n_heads / mha->n_kv_heads;
+    Tensor* group_outputs[mha->n_kv_heads];
+    for (int g = 0; g < mha->n_kv_heads; ++g) {
+        Tensor* k = linear_forward(mha->keys[g], x);
+        Tensor* v = linear_forward(mha->values[g], x);
+        group_outputs[g] = (k && v) ? head_group_forward(mha->heads + g * group_size, group_size, x, k, v) : NULL;
+        if (k) {
+            free_tensor(k);
+        }
+        if (v) {
+            free_tensor(v);
+        }
+        if (!group_outputs[g]) {
+            for (int i = 0; i < g; ++i) {
+                free_tensor(group_outputs[i]);
+            }
+            return NULL;
+        }
     }
 
-    Tensor* concatenated = concatenate((const Tensor**)head_outputs, mha->n_heads, x->n_dims - 1);
-
-    for (int i = 0; i < mha->n_heads; ++i) {
-        free_tensor(head_outputs[i]);
+    // Block r of sequence s in group g's output is head g * group_size + r
+    int n_dims = x->n_dims;
+    int T = x->shape[n_dims - 2];
+    int n_embd = x->shape[n_dims - 1];
+    int head_size = n_embd / mha->n_heads;
+    int n_seqs = x->size / ((size_t)T * n_embd);
+    Tensor* concatenated = create_tensor(x->shape, n_dims);
+    for (int g = 0; g < mha->n_kv_heads; ++g) {
+        for (int s = 0; s < n_seqs; ++s) {
+            for (int r = 0; r < group_size; ++r) {
+                const float* src = group_outputs[g]->data + ((size_t)s * group_size + r) * T * head_size;
+                float* dst = concatenated->data + (size_t)s * T * n_embd + (g * group_size + r) * head_size;
+                for (int i = 0; i < T; ++i) {
+                    memcpy(dst + (size_t)i * n_embd, src + (size_t)i * head_size, head_size * sizeof(float));
+                }
+            }
+        }
+        free_tensor(group_outputs[g]);
     }
 
     Tensor* out = linear_forward(mha->proj, concatenated);
@@ -92,3 +189,199 @@ Tensor* multi_head_attention_forward(MultiHeadAttention* mha, const Tensor* x) {
 
     return out;
 }
+
+// Function to record multi-head attention into a graph, returning its output node
+int multi_head_attention_record(MultiHeadAttention* mha, Graph* g, int x) {
+    int group_size = mha->n_heads / mha->n_kv_heads;
+    int group_outputs[mha->n_kv_heads];
+    for (int kv = 0; kv < mha->n_kv_heads; ++kv) {
+        int k = graph_linear(g, mha->keys[kv], x);
+        int v = graph_linear(g, mha->values[kv], x);
+        group_outputs[kv] = head_group_record(mha->heads + kv * group_size, group_size, g, x, k, v);
+    }
+    // The concat unstacks every group's heads into their own columns
+    return graph_linear(g, mha->proj, graph_concat(g, group_outputs, mha->n_kv_heads, group_size));
+}
+
+// Forward pass for multi-head attention over new positions of a single sequence, into out
+// x is (T_new, n_embd) for positions [past_len, past_len + T_new). Their keys and
+// values are appended to k_cache/v_cache (rows of n_kv_heads * head_size floats), and
+// every new position attends causally over all cached positions up to and including
+// itself. All query heads of a group attend together, so each shared key/value row is
+// read once per group rather than once per head.
+// Intermediates live in ws; out must not be one of its slots other than WS_BRANCH_OUT.
+int multi_head_attention_forward_cached_into(MultiHeadAttention* mha, const Tensor* x,
+                                             float* k_cache, float* v_cache, int past_len,
+                                             Tensor* out, Workspace* ws) {
+    int T_new = x->shape[0];
+    int n_embd = x->shape[1];
+    int head_size = n_embd / mha->n_heads;
+    int group_size = mha->n_heads / mha->n_kv_heads;
+    int kv_dim = mha->n_kv_heads * head_size;
+    int total_len = past_len + T_new;
+    float inv_sqrt = 1.0f / sqrtf(head_size);
+
+    // attention_group accumulates into its output rows
+    Tensor* concatenated = workspace_matrix(ws, WS_ATTN_OUT, T_new, n_embd);
+    memset(concatenated->data, 0, concatenated->size * sizeof(float));
+    float* wei = workspace_matrix(ws, WS_SCORES, group_size, total_len)->data;
+    const KernelTable* kernels = get_kernels();
+
+    for (int g = 0; g < mha->n_kv_heads; ++g) {
+        int col = g * head_size;
+
+        Tensor* k = workspace_matrix(ws, WS_K, T_new, head_size);
+        Tensor* v = workspace_matrix(ws, WS_V, T_new, head_size);
+        if (linear_forward_into(mha->keys[g], x, k) != 0 || linear_forward_into(mha->values[g], x, v) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < T_new; ++i) {
+            float* k_row = k_cache + (size_t)(past_len + i) * kv_dim + col;
+            float* v_row = v_cache + (size_t)(past_len + i) * kv_dim + col;
+            for (int d = 0; d < head_size; ++d) {
+                k_row[d] = k->data[i * head_size + d];
+                v_row[d] = v->data[i * head_size + d];
+            }
+        }
+
+        // Queries of the whole group, head-major: head r of position i is row r * T_new + i
+        Tensor* q = workspace_matrix(ws, WS_Q, group_size * T_new, head_size);
+        for (int r = 0; r < group_size; ++r) {
+            // A borrowed (T_new, head_size) view of head r's rows
+            int q_shape[] = {T_new, head_size};
+            Tensor q_rows = tensor_view(q->data + (size_t)r * T_new * head_size, q_shape, 2);
+            if (linear_forward_into(mha->heads[g * group_size + r]->query, x, &q_rows) != 0) {
+                return -1;
+            }
+        }
+
+        // The group's heads are adjacent in the concatenated output
+        for (int i = 0; i < T_new; ++i) {
+            kernels->attention_group(q->data + i * head_size, T_new * head_size, group_size,
+                                     k_cache + col, v_cache + col, kv_dim, past_len + i + 1, head_size,
+                                     inv_sqrt, wei, concatenated->data + i * n_embd + g * group_size * head_size);
+        }
+    }
+
+    return linear_forward_into(mha->proj, concatenated, out);
+}
+
+// Per-thread attention weights of the batched path
+static ThreadBuffer batched_scores_buffer = THREAD_BUFFER_INIT;
+
+// One key/value group of a batched attention pass, split into per-sequence tasks
+typedef struct {
+    const float* q;     // (group_size * n_rows, head_size), head-major as in the cached path
+    const float* k;     // (n_rows, head_size)
+    const float* v;
+    const int* offsets; // First row of each sequence, plus n_rows at the end
+    int n_rows;
+    int group_size;
+    int head_size;
+    int max_len;
+    int n_embd;
+    int out_col;        // First output column of the group
+    float scale;
+    float* out;         // (n_rows, n_embd), accumulated into
+    atomic_int failed;
+} GroupAttentionJob;
+
+// Function to attend causally within one sequence of a batched group
+static void group_attention_task(int s, void* ctx) {
+    GroupAttentionJob* job = (GroupAttentionJob*)ctx;
+    float* wei = thread_buffer(&batched_scores_buffer, (size_t)job->group_size * job->max_len);
+    if (!wei) {
+        atomic_store(&job->failed, 1);
+        return;
+    }
+    const KernelTable* kernels = get_kernels();
+    int first = job->offsets[s];
+    const float* k = job->k + (size_t)first * job->head_size;
+    const float* v = job->v + (size_t)first * job->head_size;
+    for (int i = first; i < job->offsets[s + 1]; ++i) {
+        kernels->attention_group(job->q + (size_t)i * job->head_size, job->n_rows * job->head_size, job->group_size,
+                                 k, v, job->head_size, i - first + 1, job->head_size, job->scale, wei,
+                                 job->out + (size_t)i * job->n_embd + job->out_col);
+    }
+}
+
+// Forward pass for multi-head attention over several independent sequences, into out
+// x stacks the sequences' rows: (sum of lens, n_embd), each sequence starting at
+// position 0. The projections run once over all rows, so their GEMMs see every
+// sequence at once, while each sequence attends only over its own rows. Sequences
+// are spread over the caller's threads. Intermediates live in ws; out must not be
+// one of its slots other than WS_BRANCH_OUT.
+int multi_head_attention_forward_batched_into(MultiHeadAttention* mha, const Tensor* x, const int* lens, int n_seqs,
+                                              Tensor* out, Workspace* ws) {
+    int n_rows = x->shape[0];
+    int n_embd = x->shape[1];
+    int head_size = n_embd / mha->n_heads;
+    int group_size = mha->n_heads / mha->n_kv_heads;
+
+    int offsets[n_seqs + 1];
+    int max_len = 0;
+    offsets[0] = 0;
+    for (int s = 0; s < n_seqs; ++s) {
+        offsets[s + 1] = offsets[s] + lens[s];
+        max_len = (lens[s] > max_len) ? lens[s] : max_len;
+    }
+    if (offsets[n_seqs] != n_rows) {
+        fprintf(stderr, "Sequence lengths do not add up to the %d stacked rows.\n", n_rows);
+        return -1;
+    }
+
+    // attention_group accumulates into its output rows
+    Tensor* concatenated = workspace_matrix(ws, WS_ATTN_OUT, n_rows, n_embd);
+    memset(concatenated->data, 0, concatenated->size * sizeof(float));
+
+    for (int g = 0; g < mha->n_kv_heads; ++g) {
+        Tensor* k = workspace_matrix(ws, WS_K, n_rows, head_size);
+        Tensor* v = workspace_matrix(ws, WS_V, n_rows, head_size);
+        if (linear_forward_into(mha->keys[g], x, k) != 0 || linear_forward_into(mha->values[g], x, v) != 0) {
+            return -1;
+        }
+        Tensor* q = workspace_matrix(ws, WS_Q, group_size * n_rows, head_size);
+        for (int r = 0; r < group_size; ++r) {
+            int q_shape[] = {n_rows, head_size};
+            Tensor q_rows = tensor_view(q->data + (size_t)r * n_rows * head_size, q_shape, 2);
+            if (linear_forward_into(mha->heads[g * group_size + r]->query, x, &q_rows) != 0) {
+                return -1;
+            }
+        }
+
+        GroupAttentionJob job;
+        job.q = q->data;
+        job.k = k->data;
+        job.v = v->data;
+        job.offsets = offsets;
+        job.n_rows = n_rows;
+        job.group_size = group_size;
+        job.head_size = head_size;
+        job.max_len = max_len;
+        job.n_embd = n_embd;
+        job.out_col = g * group_size * head_size;
+        job.scale = 1.0f / sqrtf(head_size);
+        job.out = concatenated->data;
+        atomic_init(&job.failed, 0);
+        parallel_for(n_seqs, group_attention_task, &job);
+        if (atomic_load(&job.failed)) {
+            fprintf(stderr, "Error: failed to allocate attention scores.\n");
+            return -1;
+        }
+    }
+
+    return linear_forward_into(mha->proj, concatenated, out);
+}
+
+// Forward pass for multi-head attention over new positions of a single sequence
+Tensor* multi_head_attention_forward_cached(MultiHeadAttention* mha, const Tensor* x,
+                                            float* k_cache, float* v_cache, int past_len) {
+    Workspace* ws = create_workspace();
+    Tensor* out = create_tensor(x->shape, x->n_dims);
+    if (multi_head_attention_forward_cached_into(mha, x, k_cache, v_cache, past_len, out, ws) != 0) {
+        free_tensor(out);
+        out = NULL;
+    }
+    free_workspace(ws);
+    return out;
+}
@@ -3,30 +3,48 @@
 
 #include "tensor.h"
 #include "linear.h"
+#include "workspace.h"
+#include "graph.h"
 
-// A single head of self-attention
+// A single (query) head of self-attention
+// Its keys and values come from the key/value projections of its group in the
+// owning MultiHeadAttention.
 typedef struct {
-    Linear* key;
     Linear* query;
-    Linear* value;
     Tensor* tril;
     float dropout; // Dropout is not implemented, but included for completeness
 } Head;
 
 // Multi-head attention module
+// Query heads are split into n_kv_heads groups of n_heads / n_kv_heads consecutive
+// heads, and each group shares one key and one value projection: n_kv_heads ==
+// n_heads is standard multi-head attention, 1 is multi-query attention and anything
+// in between is grouped-query attention.
 typedef struct {
     Head** heads;
     int n_heads;
+    Linear** keys;   // One per key/value head
+    Linear** values;
+    int n_kv_heads;
     Linear* proj;
 } MultiHeadAttention;
 
 // Function prototypes
 Head* create_head(int n_embd, int head_size);
 void free_head(Head* head);
-Tensor* head_forward(Head* head, const Tensor* x);
+Tensor* head_group_forward(Head** heads, int group_size, const Tensor* x, const Tensor* k, const Tensor* v);
+int head_group_record(Head** heads, int group_size, Graph* g, int x, int k, int v);
 
-MultiHeadAttention* create_multi_head_attention(int n_embd, int n_heads);
+MultiHeadAttention* create_multi_head_attention(int n_embd, int n_heads, int n_kv_heads);
 void free_multi_head_attention(MultiHeadAttention* mha);
 Tensor* multi_head_attention_forward(MultiHeadAttention* mha, const Tensor* x);
+int multi_head_attention_record(MultiHeadAttention* mha, Graph* g, int x);
+Tensor* multi_head_attention_forward_cached(MultiHeadAttention* mha, const Tensor* x,
+                                            float* k_cache, float* v_cache, int past_len);
+int multi_head_attention_forward_cached_into(MultiHeadAttention* mha, const Tensor* x,
+                                             float* k_cache, float* v_cache, int past_len,
+                                             Tensor* out, Workspace* ws);
+int multi_head_attention_forward_batched_into(MultiHeadAttention* mha, const Tensor* x, const int* lens, int n_seqs,
+                                              Tensor* out, Workspace* ws);
 
 #endif // ATTENTION_H
@@ -1,9 +1,15 @@
 #include "block.h"
+#include <string.h>
 
 // Function to create a new Transformer Block
-Block* create_block(int n_embd, int n_head) {
+// Groups of n_head / n_kv_head query heads share one key/value head.
+Block* create_block(int n_embd, int n_head, int n_kv_head) {
+    MultiHeadAttention* sa = create_multi_head_attention(n_embd, n_head, n_kv_head);
+    if (!sa) {
+        return NULL;
+    }
     Block* block = (Block*)malloc(sizeof(Block));
-    block->sa = create_multi_head_attention(n_embd, n_head);
+    block->sa = sa;
     block->ffwd = create_feed_forward(n_embd);
     block->ln1 = create_layer_norm(n_embd);
     block->ln2 = create_layer_norm(n_embd);
@@ -31,10 +37,73 @@ Tensor* block_forward(Block* block, const Tensor* x) {
     // Feed-forward with residual connection and layer normalization
     Tensor* ln2_out = layer_norm_forward(block->ln2, x1);
     Tensor* ffwd_out = feed_forward_forward(block->ffwd, ln2_out);
-    Tensor* x2 = add(x1, ffwd_out);
+    add_(x1, ffwd_out);
     free_tensor(ln2_out);
     free_tensor(ffwd_out);
-    free_tensor(x1);
 
-    return x2;
+    return x1;
+}
+
+// Function to record the Transformer Block into a graph, returning the new residual node
+// Each residual add reads the branch first so it fuses after the branch's bias, and
+// the following LayerNorm fuses after the add.
+int block_record(Block* block, Graph* g, int x) {
+    int sa_out = multi_head_attention_record(block->sa, g, graph_layer_norm(g, block->ln1, x));
+    int x1 = graph_add(g, sa_out, x);
+    int ffwd_out = feed_forward_record(block->ffwd, g, graph_layer_norm(g, block->ln2, x1));
+    return graph_add(g, ffwd_out, x1);
+}
+
+// Forward pass for the Transformer Block over new positions of a single sequence
+// x is the residual stream and is updated in place; intermediates live in ws.
+int block_forward_cached_into(Block* block, Tensor* x, float* k_cache, float* v_cache, int past_len, Workspace* ws) {
+    Tensor* ln_out = workspace_matrix(ws, WS_LN_OUT, x->shape[0], x->shape[1]);
+    Tensor* branch_out = workspace_matrix(ws, WS_BRANCH_OUT, x->shape[0], x->shape[1]);
+
+    if (layer_norm_forward_into(block->ln1, x, ln_out) != 0 ||
+        multi_head_attention_forward_cached_into(block->sa, ln_out, k_cache, v_cache, past_len, branch_out, ws) != 0) {
+        return -1;
+    }
+    add_(x, branch_out);
+
+    if (layer_norm_forward_into(block->ln2, x, ln_out) != 0 ||
+        feed_forward_forward_into(block->ffwd, ln_out, branch_out, ws) != 0) {
+        return -1;
+    }
+    add_(x, branch_out);
+    return 0;
+}
+
+// Forward pass for the Transformer Block over several stacked sequences
+// x holds the rows of n_seqs sequences of lens[i] positions each, back to back, and
+// is updated in place; see multi_head_attention_forward_batched_into.
+int block_forward_batched_into(Block* block, Tensor* x, const int* lens, int n_seqs, Workspace* ws) {
+    Tensor* ln_out = workspace_matrix(ws, WS_LN_OUT, x->shape[0], x->shape[1]);
+    Tensor* branch_out = workspace_matrix(ws, WS_BRANCH_OUT, x->shape[0], x->shape[1]);
+
+    if (layer_norm_forward_into(block->ln1, x, ln_out) != 0 ||
+        multi_head_attention_forward_batched_into(block->sa, ln_out, lens, n_seqs, branch_out, ws) != 0) {
+        return -1;
+    }
+    add_(x, branch_out);
+
+    if (layer_norm_forward_into(block->ln2, x, ln_out) != 0 ||
+        feed_forward_forward_into(block->ffwd, ln_out, branch_out, ws) != 0) {
+        return -1;
+    }
+    add_(x, branch_out);
+    return 0;
+}
+
+// Forward pass for the Transformer Block over new positions of a single sequence
+Tensor* block_forward_cached(Block* block, const Tensor* x, float* k_cache, float* v_cache, int past_len) {
+    Workspace* ws = create_workspace();
+    Tensor* out = create_tensor(x->shape, x->n_dims);
+    memcpy(out->data, x->data, x->size * sizeof(float));
+    if (block_forward_cached_into(block, out, k_cache, v_cache, past_len, ws) != 0) {
+        free_tensor(out);
+        out = NULL;
+    }
+    free_workspace(ws);
+    return out;
 }
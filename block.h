@@ -15,8 +15,12 @@ typedef struct {
 } Block;
 
 // Function prototypes
-Block* create_block(int n_embd, int n_head);
+Block* create_block(int n_embd, int n_head, int n_kv_head);
 void free_block(Block* block);
 Tensor* block_forward(Block* block, const Tensor* x);
+int block_record(Block* block, Graph* g, int x);
+Tensor* block_forward_cached(Block* block, const Tensor* x, float* k_cache, float* v_cache, int past_len);
+int block_forward_cached_into(Block* block, Tensor* x, float* k_cache, float* v_cache, int past_len, Workspace* ws);
+int block_forward_batched_into(Block* block, Tensor* x, const int* lens, int n_seqs, Workspace* ws);
 
 #endif // BLOCK_H
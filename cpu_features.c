@@ -0,0 +1,105 @@
+#include "cpu_features.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+// Function to read XCR0, which says which register states the OS saves
+static uint64_t read_xcr0(void) {
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+}
+#endif
+
+static const char* tier_names[CPU_TIER_COUNT] = {"scalar", "sse", "avx2", "avx512"};
+
+// Function to find the best tier supported by both the CPU and the OS
+CpuTier cpu_detect_tier(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return CPU_TIER_SSE;
+    }
+    int has_fma = (ecx >> 12) & 1;
+    int has_osxsave = (ecx >> 27) & 1;
+    int has_avx = (ecx >> 28) & 1;
+    if (!has_osxsave || !has_avx) {
+        return CPU_TIER_SSE;
+    }
+
+    uint64_t xcr0 = read_xcr0();
+    int os_ymm = (xcr0 & 0x6) == 0x6;     // XMM and YMM state
+    int os_zmm = (xcr0 & 0xe6) == 0xe6;   // plus opmask and ZMM state
+    if (!os_ymm || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return CPU_TIER_SSE;
+    }
+
+    int has_avx2 = (ebx >> 5) & 1;
+    int has_avx512f = (ebx >> 16) & 1;
+    int has_avx512dq = (ebx >> 17) & 1;
+    int has_avx512vl = (ebx >> 31) & 1;
+    if (has_avx2 && has_fma && os_zmm && has_avx512f && has_avx512dq && has_avx512vl) {
+        return CPU_TIER_AVX512;
+    }
+    if (has_avx2 && has_fma) {
+        return CPU_TIER_AVX2;
+    }
+    return CPU_TIER_SSE;
+#else
+    return CPU_TIER_SSE;
+#endif
+}
+
+// Function to get the printable name of a tier
+const char* cpu_tier_name(CpuTier tier) {
+    return (tier >= 0 && tier < CPU_TIER_COUNT) ? tier_names[tier] : "unknown";
+}
+
+// Function to parse a tier name, returning -1 if it is not recognized
+int cpu_tier_from_name(const char* name) {
+    for (int i = 0; i < CPU_TIER_COUNT; ++i) {
+        if (strcmp(name, tier_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Function to get the CPU brand string (e.g. for keying per-host tuning data)
+// Falls back to the architecture name when the CPU does not report one.
+const char* cpu_model_name(void) {
+    static char name[49];
+    if (name[0] != '\0') {
+        return name;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int regs[12];
+    unsigned int max_leaf = __get_cpuid_max(0x80000000, NULL);
+    if (max_leaf >= 0x80000004) {
+        for (unsigned int i = 0; i < 3; ++i) {
+            __get_cpuid(0x80000002 + i, &regs[4 * i], &regs[4 * i + 1], &regs[4 * i + 2], &regs[4 * i + 3]);
+        }
+        memcpy(name, regs, sizeof(regs));
+        name[48] = '\0';
+    }
+#endif
+    // Trim the padding some vendors put around the brand string
+    char* start = name;
+    while (*start == ' ') {
+        start++;
+    }
+    memmove(name, start, strlen(start) + 1);
+    for (int i = (int)strlen(name) - 1; i >= 0 && (name[i] == ' ' || name[i] == '\t'); --i) {
+        name[i] = '\0';
+    }
+    if (name[0] == '\0') {
+#if defined(__aarch64__)
+        strcpy(name, "generic-aarch64");
+#else
+        strcpy(name, "generic");
+#endif
+    }
+    return name;
+}
@@ -0,0 +1,19 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+// Instruction-set tiers with a compiled kernel table, in increasing order
+typedef enum {
+    CPU_TIER_SCALAR = 0,
+    CPU_TIER_SSE = 1,    // 128-bit vectors (SSE2 on x86-64, the generic fallback elsewhere)
+    CPU_TIER_AVX2 = 2,   // AVX2 + FMA
+    CPU_TIER_AVX512 = 3, // AVX-512 F/DQ/VL
+    CPU_TIER_COUNT
+} CpuTier;
+
+// Function prototypes
+CpuTier cpu_detect_tier(void);
+const char* cpu_tier_name(CpuTier tier);
+int cpu_tier_from_name(const char* name);
+const char* cpu_model_name(void);
+
+#endif // CPU_FEATURES_H
@@ -1,6 +1,7 @@
 #include "data.h"
 #include <stdlib.h>
 #include <string.h>
+#include "rng.h"
 
 // Function to read the entire content of a file into a string
 char* read_file_content(const char* filepath) {
@@ -100,15 +101,20 @@ char* decode(const int* encoded_text, int len, Vocabulary* vocab) {
 }
 
 // Function to get a batch of data for training
+// Batch n draws its offsets from stream (RNG_BATCH, n); row b uses word b, so rows
+// can be filled in any order or in parallel with the same result. Tensors already
+// in *x and *y are reused (resized to (batch_size, block_size)); NULL ones are created.
 void get_batch(const int* data, int data_len, int batch_size, int block_size, Tensor** x, Tensor** y) {
     int x_shape[] = {batch_size, block_size};
     int y_shape[] = {batch_size, block_size};
 
-    *x = create_tensor(x_shape, 2);
-    *y = create_tensor(y_shape, 2);
+    *x = resize_tensor(*x, x_shape, 2);
+    *y = resize_tensor(*y, y_shape, 2);
 
+    RngStream rng = rng_stream(RNG_BATCH, rng_next_stream_id(RNG_BATCH));
     for (int b = 0; b < batch_size; ++b) {
-        int ix = rand() % (data_len - block_size);
+        rng_seek(&rng, b);
+        int ix = rng_uniform_int(&rng, data_len - block_size);
         for (int t = 0; t < block_size; ++t) {
             int x_indices[] = {b, t};
             int y_indices[] = {b, t};
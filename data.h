@@ -2,6 +2,7 @@
 #define DATA_H
 
 #include <stdio.h>
+#include "tensor.h"
 
 // Structure to hold the vocabulary and its size
 typedef struct {
@@ -0,0 +1,184 @@
+#include "eval.h"
+#include "threads.h"
+#include "pipeline.h"
+#include "vmath.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Layout of the strided sliding windows over a split
+// Position p predicts data[p + 1] from data[begin .. p], for p in [0, n_targets).
+typedef struct {
+    BigramLanguageModel* model;
+    const int* data;
+    int n_targets;  // data_len - 1
+    int context;    // Window length (<= block_size)
+    int stride;     // Distance between window starts
+    double* nll;    // Per-window sum of negative log-likelihoods
+    long* counted;  // Per-window number of scored positions
+} EvalJob;
+
+// Function to get the end (exclusive) of the positions covered by window w
+static int window_end(const EvalJob* job, int w) {
+    int end = w * job->stride + job->context;
+    return (end < job->n_targets) ? end : job->n_targets;
+}
+
+// Function to compute -log softmax(row)[target] in the same way as cross_entropy_loss
+static double row_nll(const float* row, int vocab_size, int target) {
+    return (double)row_logsumexp(row, vocab_size) - row[target];
+}
+
+// Function to get the first position of window w that no earlier window scored
+static int window_first_scored(const EvalJob* job, int w) {
+    return (w == 0) ? 0 : window_end(job, w - 1);
+}
+
+// Function to score window w from logits whose row 0 is position first_row
+static void score_window(EvalJob* job, int w, const Tensor* logits, int first_row) {
+    double nll = 0.0;
+    long counted = 0;
+    if (logits) {
+        int vocab_size = logits->shape[logits->n_dims - 1];
+        for (int p = window_first_scored(job, w); p < window_end(job, w); ++p) {
+            const float* row = logits->data + (size_t)(p - first_row) * vocab_size;
+            nll += row_nll(row, vocab_size, job->data[p + 1]);
+            counted++;
+        }
+    }
+    job->nll[w] = nll;
+    job->counted[w] = counted;
+}
+
+// Evaluate a single window; only the positions not scored by the previous window count
+static void eval_window(int w, void* ctx) {
+    EvalJob* job = (EvalJob*)ctx;
+    int begin = w * job->stride;
+    int len = window_end(job, w) - begin;
+
+    Tensor* logits = model_forward_tokens(job->model, job->data + begin, len);
+    score_window(job, w, logits, begin);
+    if (logits) {
+        free_tensor(logits);
+    }
+}
+
+// Function to lay out the windows of a split, returning their number (0 if too short)
+static int init_eval_job(EvalJob* job, BigramLanguageModel* model, const int* data, int data_len,
+                         int block_size, int stride) {
+    if (data_len < 2) {
+        fprintf(stderr, "Split is too short to evaluate.\n");
+        return 0;
+    }
+    job->model = model;
+    job->data = data;
+    job->n_targets = data_len - 1;
+    job->context = (block_size < job->n_targets) ? block_size : job->n_targets;
+    job->stride = (stride > 0 && stride <= job->context) ? stride : job->context;
+
+    int n_windows = 1;
+    if (job->n_targets > job->context) {
+        n_windows += (job->n_targets - job->context + job->stride - 1) / job->stride;
+    }
+    job->nll = (double*)calloc(n_windows, sizeof(double));
+    job->counted = (long*)calloc(n_windows, sizeof(long));
+    return n_windows;
+}
+
+// Function to reduce per-window results in window order and release the job
+static EvalResult finish_eval_job(EvalJob* job, int n_windows, double seconds) {
+    EvalResult result = {0};
+    result.seconds = seconds;
+
+    // Deterministic reduction in window order
+    double total_nll = 0.0;
+    for (int w = 0; w < n_windows; ++w) {
+        total_nll += job->nll[w];
+        result.n_tokens += job->counted[w];
+    }
+    free(job->nll);
+    free(job->counted);
+
+    if (result.n_tokens > 0) {
+        result.loss = total_nll / result.n_tokens;
+        result.perplexity = exp(result.loss);
+    }
+    if (result.seconds > 0.0) {
+        result.tokens_per_sec = result.n_tokens / result.seconds;
+    }
+    return result;
+}
+
+// Function to compute the exact average loss and perplexity over a whole split
+// Windows of block_size tokens start every `stride` tokens; each target is scored
+// exactly once, by the first window that reaches it, so every scored token after
+// the first window sees at least block_size - stride tokens of context.
+// Windows are evaluated in parallel and reduced in window order, so the result
+// does not depend on the number of threads.
+EvalResult evaluate_split(BigramLanguageModel* model, const int* data, int data_len, int block_size, int stride) {
+    EvalResult result = {0};
+    EvalJob job;
+    int n_windows = init_eval_job(&job, model, data, data_len, block_size, stride);
+    if (n_windows == 0) {
+        return result;
+    }
+
+    double start = now_seconds();
+    parallel_for(n_windows, eval_window, &job);
+    return finish_eval_job(&job, n_windows, now_seconds() - start);
+}
+
+// State of the last pipeline stage while scoring windows
+typedef struct {
+    EvalJob* job;
+    Tensor* logits; // Reused lm_head output of the scored rows
+} PipelinedEval;
+
+// Pipeline sink: apply lm_head to the rows window w scores and accumulate their loss
+static void score_window_hidden(int w, const Tensor* hidden, void* ctx) {
+    PipelinedEval* pe = (PipelinedEval*)ctx;
+    int first = window_first_scored(pe->job, w);
+    int n_scored = window_end(pe->job, w) - first;
+    int ok = model_logits_last_into(pe->job->model, hidden, n_scored, pe->logits) == 0;
+    score_window(pe->job, w, ok ? pe->logits : NULL, first);
+}
+
+// Function to compute the same result as evaluate_split with layer pipelining
+// The windows flow through n_stages pipeline stages in micro-batches of micro_batch
+// windows (see pipeline_forward). stats may be NULL; otherwise release it with
+// free_pipeline_stats.
+EvalResult evaluate_split_pipelined(BigramLanguageModel* model, const int* data, int data_len, int block_size,
+                                    int stride, int n_stages, int micro_batch, PipelineStats* stats) {
+    EvalResult result = {0};
+    EvalJob job;
+    int n_windows = init_eval_job(&job, model, data, data_len, block_size, stride);
+    if (n_windows == 0) {
+        return result;
+    }
+
+    const int** tokens = (const int**)malloc(n_windows * sizeof(int*));
+    int* lens = (int*)malloc(n_windows * sizeof(int));
+    for (int w = 0; w < n_windows; ++w) {
+        tokens[w] = data + (size_t)w * job.stride;
+        lens[w] = window_end(&job, w) - w * job.stride;
+    }
+    int logits_shape[] = {job.context, model->lm_head->weights->shape[1]};
+    PipelinedEval pe = {&job, create_tensor(logits_shape, 2)};
+
+    double start = now_seconds();
+    pipeline_forward(model, (const int* const*)tokens, lens, n_windows, n_stages, micro_batch,
+                     score_window_hidden, &pe, stats);
+    result = finish_eval_job(&job, n_windows, now_seconds() - start);
+
+    free_tensor(pe.logits);
+    free(tokens);
+    free(lens);
+    return result;
+}
+
+// Function to print an evaluation result on one line
+void print_eval_result(const char* label, const EvalResult* result) {
+    printf("%s loss %.4f, perplexity %.3f (%ld tokens in %.2fs, %.1f tokens/sec)\n",
+           label, result->loss, result->perplexity, result->n_tokens,
+           result->seconds, result->tokens_per_sec);
+}
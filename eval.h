@@ -0,0 +1,22 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include "model.h"
+#include "pipeline.h"
+
+// Result of evaluating the model over a held-out split
+typedef struct {
+    double loss;           // Mean negative log-likelihood per scored token
+    double perplexity;     // exp(loss)
+    long n_tokens;         // Number of scored target positions
+    double seconds;        // Wall-clock time spent in the evaluation
+    double tokens_per_sec; // Eval throughput
+} EvalResult;
+
+// Function prototypes
+EvalResult evaluate_split(BigramLanguageModel* model, const int* data, int data_len, int block_size, int stride);
+EvalResult evaluate_split_pipelined(BigramLanguageModel* model, const int* data, int data_len, int block_size,
+                                    int stride, int n_stages, int micro_batch, PipelineStats* stats);
+void print_eval_result(const char* label, const EvalResult* result);
+
+#endif // EVAL_H
@@ -15,18 +15,41 @@ void free_feed_forward(FeedForward* ffwd) {
     free(ffwd);
 }
 
+// Forward pass for the FeedForward layer into out, with the hidden activations in ws
+int feed_forward_forward_into(FeedForward* ffwd, const Tensor* input, Tensor* out, Workspace* ws) {
+    Tensor* hidden = workspace_matrix(ws, WS_FFN_HIDDEN, input->shape[0], ffwd->layer1->weights->shape[1]);
+    if (linear_forward_into(ffwd->layer1, input, hidden) != 0) {
+        return -1;
+    }
+
+    // Apply ReLU activation
+    relu_(hidden);
+
+    return linear_forward_into(ffwd->layer2, hidden, out);
+}
+
 // Forward pass for the FeedForward layer
 Tensor* feed_forward_forward(FeedForward* ffwd, const Tensor* input) {
     Tensor* hidden = linear_forward(ffwd->layer1, input);
 
     // Apply ReLU activation
-    for (int i = 0; i < hidden->size; ++i) {
-        if (hidden->data[i] < 0) {
-            hidden->data[i] = 0;
-        }
-    }
+    relu_(hidden);
 
     Tensor* output = linear_forward(ffwd->layer2, hidden);
     free_tensor(hidden);
     return output;
 }
+
+// Function to record the FeedForward layer into a graph, returning its output node
+int feed_forward_record(FeedForward* ffwd, Graph* g, int x) {
+    int hidden = graph_relu(g, graph_linear(g, ffwd->layer1, x));
+    return graph_linear(g, ffwd->layer2, hidden);
+}
+
+// Function to prune both FeedForward Linear layers to 2:4 sparsity
+int feed_forward_prune_2_4(FeedForward* ffwd) {
+    if (linear_prune_2_4(ffwd->layer1) != 0 || linear_prune_2_4(ffwd->layer2) != 0) {
+        return -1;
+    }
+    return 0;
+}
@@ -3,6 +3,8 @@
 
 #include "tensor.h"
 #include "linear.h"
+#include "workspace.h"
+#include "graph.h"
 
 // A simple FeedForward layer
 typedef struct {
@@ -15,5 +17,8 @@ typedef struct {
 FeedForward* create_feed_forward(int n_embd);
 void free_feed_forward(FeedForward* ffwd);
 Tensor* feed_forward_forward(FeedForward* ffwd, const Tensor* input);
+int feed_forward_forward_into(FeedForward* ffwd, const Tensor* input, Tensor* out, Workspace* ws);
+int feed_forward_record(FeedForward* ffwd, Graph* g, int x);
+int feed_forward_prune_2_4(FeedForward* ffwd);
 
 #endif // FEED_FORWARD_H
@@ -0,0 +1,413 @@
+#include "gemm_tune.h"
+#include "threads.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// First line of every tuning file; files with another header are ignored
+#define TUNING_HEADER "# gptc GEMM tuning v1: cpu\ttier\tm k n\tmr kc nc threads\tgflops"
+
+// One tuned shape on one host and tier
+typedef struct {
+    char cpu[64];
+    char tier[16];
+    int m;
+    int k;
+    int n;
+    GemmConfig cfg;
+    float gflops;
+} TuneEntry;
+
+typedef struct {
+    TuneEntry* entries;
+    int n_entries;
+    int capacity;
+} TuneTable;
+
+// Entries for this host and tier only, filled once by gemm_tuning_load
+static pthread_once_t tuning_once = PTHREAD_ONCE_INIT;
+static TuneTable host_table;
+
+// Function to get the path of the tuning cache
+const char* gemm_tuning_path(void) {
+    const char* env = getenv("GPTC_GEMM_TUNING");
+    return (env && env[0] != '\0') ? env : GEMM_TUNING_FILE;
+}
+
+// Function to bucket a row count: exact up to 8 rows, then the next power of two
+static int m_bucket(int m) {
+    if (m <= 8) {
+        return m;
+    }
+    int bucket = 16;
+    while (bucket < m && bucket < GEMM_TUNE_MAX_M) {
+        bucket *= 2;
+    }
+    return bucket;
+}
+
+// Function to append an entry, replacing any entry with the same key
+static void table_put(TuneTable* table, const TuneEntry* entry) {
+    for (int i = 0; i < table->n_entries; ++i) {
+        TuneEntry* e = &table->entries[i];
+        if (e->m == entry->m && e->k == entry->k && e->n == entry->n &&
+            strcmp(e->cpu, entry->cpu) == 0 && strcmp(e->tier, entry->tier) == 0) {
+            *e = *entry;
+            return;
+        }
+    }
+    if (table->n_entries == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 32;
+        table->entries = (TuneEntry*)realloc(table->entries, table->capacity * sizeof(TuneEntry));
+    }
+    table->entries[table->n_entries++] = *entry;
+}
+
+// Function to parse one "cpu\ttier\tm k n\tmr kc nc threads\tgflops" line
+static int parse_entry(char* line, TuneEntry* entry) {
+    char* fields[5];
+    char* save = NULL;
+    int n_fields = 0;
+    for (char* f = strtok_r(line, "\t\r\n", &save); f && n_fields < 5; f = strtok_r(NULL, "\t\r\n", &save)) {
+        fields[n_fields++] = f;
+    }
+    if (n_fields != 5) {
+        return -1;
+    }
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->cpu, sizeof(entry->cpu), "%s", fields[0]);
+    snprintf(entry->tier, sizeof(entry->tier), "%s", fields[1]);
+    if (sscanf(fields[2], "%d %d %d", &entry->m, &entry->k, &entry->n) != 3 ||
+        sscanf(fields[3], "%d %d %d %d", &entry->cfg.mr, &entry->cfg.kc, &entry->cfg.nc,
+               &entry->cfg.threads) != 4 ||
+        sscanf(fields[4], "%f", &entry->gflops) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+// Function to read every entry of a tuning file (all hosts), returning -1 if it is unreadable
+static int read_tuning_file(const char* path, TuneTable* table) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    char line[512];
+    if (!fgets(line, sizeof(line), file) || strncmp(line, TUNING_HEADER, strlen(TUNING_HEADER)) != 0) {
+        fprintf(stderr, "GEMM tuning: %s has an unknown format, ignoring it.\n", path);
+        fclose(file);
+        return -1;
+    }
+    int line_no = 1;
+    while (fgets(line, sizeof(line), file)) {
+        line_no++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        TuneEntry entry;
+        if (parse_entry(line, &entry) != 0) {
+            fprintf(stderr, "GEMM tuning: skipping malformed line %d of %s.\n", line_no, path);
+            continue;
+        }
+        table_put(table, &entry);
+    }
+    fclose(file);
+    return 0;
+}
+
+// Function to load the entries matching this CPU model and kernel tier
+static void load_host_entries(void) {
+    const char* path = gemm_tuning_path();
+    const char* cpu = cpu_model_name();
+    const char* tier = get_kernels()->name;
+
+    TuneTable all = {0};
+    if (read_tuning_file(path, &all) != 0) {
+        fprintf(stderr, "GEMM tuning: no cache at %s, using heuristics.\n", path);
+        return;
+    }
+    for (int i = 0; i < all.n_entries; ++i) {
+        if (strcmp(all.entries[i].cpu, cpu) == 0 && strcmp(all.entries[i].tier, tier) == 0) {
+            table_put(&host_table, &all.entries[i]);
+        }
+    }
+    fprintf(stderr, "GEMM tuning: %d of %d entries in %s match this host (%s, %s).\n",
+            host_table.n_entries, all.n_entries, path, cpu, tier);
+    free(all.entries);
+}
+
+// Function to load the tuning cache once (later calls are no-ops)
+void gemm_tuning_load(void) {
+    pthread_once(&tuning_once, load_host_entries);
+}
+
+// Threads of untuned GEMMs started on this thread (see gemm_set_default_threads)
+static __thread int default_threads = 1;
+
+// Function to set the threads the heuristic gives GEMMs started on the calling thread
+// For threads that own a share of the cores (pipeline stages); tuned entries keep
+// their measured thread count. Both are capped by get_thread_budget().
+void gemm_set_default_threads(int n_threads) {
+    default_threads = (n_threads > 0) ? n_threads : 1;
+}
+
+// Function to pick a blocking without measurements
+// Small m uses the shortest register tile that covers it so no rows are wasted;
+// deep K is split so one A row strip and a panel block stay in L1/L2.
+GemmConfig gemm_heuristic_config(int m, int k, int n) {
+    (void)n;
+    const KernelTable* kernels = get_kernels();
+    GemmConfig cfg;
+    cfg.mr = kernels->gemm_default_mr;
+    if (m < cfg.mr) {
+        for (int i = 0; i < kernels->n_gemm_mr_options; ++i) {
+            int option = kernels->gemm_mr_options[i];
+            if (option >= m && option < cfg.mr) {
+                cfg.mr = option;
+            }
+        }
+    }
+    cfg.kc = (k <= 512) ? 0 : 256;
+    cfg.nc = 0;
+    cfg.threads = default_threads;
+    return cfg;
+}
+
+// Function to get the blocking for a shape: the tuned entry if there is one, else the heuristic
+GemmConfig gemm_config_for(int m, int k, int n) {
+    gemm_tuning_load();
+    int bucket = m_bucket(m);
+    for (int i = 0; i < host_table.n_entries; ++i) {
+        const TuneEntry* e = &host_table.entries[i];
+        if (e->m == bucket && e->k == k && e->n == n) {
+            return e->cfg;
+        }
+    }
+    return gemm_heuristic_config(m, k, n);
+}
+
+// Row slice of one GEMM handed to a worker thread
+typedef struct {
+    const float* a;
+    int m;
+    const PackedMatrix* b;
+    float* c;
+    const GemmConfig* cfg;
+    int rows_per_task;
+} GemmJob;
+
+static void gemm_task(int task, void* ctx) {
+    GemmJob* job = (GemmJob*)ctx;
+    int r0 = task * job->rows_per_task;
+    int rows = (job->m - r0 < job->rows_per_task) ? (job->m - r0) : job->rows_per_task;
+    get_kernels()->gemm_packed(job->a + (size_t)r0 * job->b->k, rows, job->b,
+                               job->c + (size_t)r0 * job->b->n, job->cfg);
+}
+
+// Function to compute C[m, n] = A[m, k] * packed B with an explicit blocking
+// Threads split the rows in whole register tiles; nested calls run serially.
+void gemm_packed_config(const float* a, int m, const PackedMatrix* b, float* c, const GemmConfig* cfg) {
+    int threads = cfg ? cfg->threads : 1;
+    int mr = (cfg && cfg->mr > 0) ? cfg->mr : 1;
+    if (threads > get_thread_budget()) {
+        threads = get_thread_budget();
+    }
+    if (threads <= 1 || m < 2 * mr) {
+        get_kernels()->gemm_packed(a, m, b, c, cfg);
+        return;
+    }
+
+    GemmJob job = {a, m, b, c, cfg, 0};
+    int rows = (m + threads - 1) / threads;
+    job.rows_per_task = (rows + mr - 1) / mr * mr;
+    parallel_for((m + job.rows_per_task - 1) / job.rows_per_task, gemm_task, &job);
+}
+
+// Column slice of one sparse GEMM handed to a worker thread
+typedef struct {
+    const float* a;
+    int m;
+    const SparseMatrix* b;
+    float* c;
+    int n_panels;
+    int panels_per_task;
+} SparseGemmJob;
+
+static void sparse_gemm_task(int task, void* ctx) {
+    SparseGemmJob* job = (SparseGemmJob*)ctx;
+    int p0 = task * job->panels_per_task;
+    int p1 = (p0 + job->panels_per_task < job->n_panels) ? p0 + job->panels_per_task : job->n_panels;
+    get_kernels()->gemm_sparse(job->a, job->m, job->b, job->c, p0, p1);
+}
+
+// Function to compute C[m, n] = A[m, k] * 2:4 sparse B on cfg->threads threads
+// Threads split the column panels rather than the rows, so single-row decode
+// steps are parallel too; only the thread count of cfg applies.
+void gemm_sparse_config(const float* a, int m, const SparseMatrix* b, float* c, const GemmConfig* cfg) {
+    int n_panels = (b->n + GEMM_NR - 1) / GEMM_NR;
+    int threads = cfg ? cfg->threads : 1;
+    if (threads > get_thread_budget()) {
+        threads = get_thread_budget();
+    }
+    if (threads > n_panels) {
+        threads = n_panels;
+    }
+    if (threads <= 1) {
+        get_kernels()->gemm_sparse(a, m, b, c, 0, n_panels);
+        return;
+    }
+
+    SparseGemmJob job = {a, m, b, c, n_panels, (n_panels + threads - 1) / threads};
+    parallel_for((n_panels + job.panels_per_task - 1) / job.panels_per_task, sparse_gemm_task, &job);
+}
+
+// Function to measure one configuration in GFLOP/s
+static double time_config(const float* a, int m, const PackedMatrix* b, float* c, const GemmConfig* cfg) {
+    gemm_packed_config(a, m, b, c, cfg); // Warm caches and thread stacks
+    int reps = 0;
+    double start = now_seconds();
+    double elapsed = 0.0;
+    do {
+        gemm_packed_config(a, m, b, c, cfg);
+        reps++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < GEMM_TUNE_MIN_SECONDS || reps < 3);
+    return 2.0 * m * b->k * b->n * reps / elapsed * 1e-9;
+}
+
+// Function to add a value to a candidate list unless it is already there
+static int add_unique(int* values, int n_values, int value) {
+    for (int i = 0; i < n_values; ++i) {
+        if (values[i] == value) {
+            return n_values;
+        }
+    }
+    values[n_values] = value;
+    return n_values + 1;
+}
+
+// Function to benchmark one shape over the candidate space and return the fastest entry
+static TuneEntry tune_shape(int m, int k, int n, double* heuristic_gflops) {
+    const KernelTable* kernels = get_kernels();
+    float* a = (float*)malloc((size_t)m * k * sizeof(float));
+    float* b = (float*)malloc((size_t)k * n * sizeof(float));
+    float* c = (float*)malloc((size_t)m * n * sizeof(float));
+    for (size_t i = 0; i < (size_t)m * k; ++i) {
+        a[i] = (float)((i * 7919) % 1000) / 1000.0f - 0.5f;
+    }
+    for (size_t i = 0; i < (size_t)k * n; ++i) {
+        b[i] = (float)((i * 104729) % 1000) / 1000.0f - 0.5f;
+    }
+    PackedMatrix* packed = pack_matrix(b, k, n);
+    int n_panels = (n + GEMM_NR - 1) / GEMM_NR;
+
+    int kcs[4], n_kcs = 0;
+    n_kcs = add_unique(kcs, n_kcs, 0);
+    for (int kc = 512; kc >= 128; kc /= 2) {
+        if (kc < k) {
+            n_kcs = add_unique(kcs, n_kcs, kc);
+        }
+    }
+    int ncs[3], n_ncs = 0;
+    n_ncs = add_unique(ncs, n_ncs, 0);
+    if (32 < n_panels) {
+        n_ncs = add_unique(ncs, n_ncs, 32);
+    }
+    if (8 < n_panels) {
+        n_ncs = add_unique(ncs, n_ncs, 8);
+    }
+    int threads[2], n_threads = 0;
+    n_threads = add_unique(threads, n_threads, 1);
+    n_threads = add_unique(threads, n_threads, get_num_threads());
+
+    GemmConfig heuristic = gemm_heuristic_config(m, k, n);
+    *heuristic_gflops = time_config(a, m, packed, c, &heuristic);
+
+    TuneEntry best;
+    memset(&best, 0, sizeof(best));
+    best.cfg = heuristic;
+    best.gflops = (float)*heuristic_gflops;
+    for (int i = 0; i < kernels->n_gemm_mr_options; ++i) {
+        for (int j = 0; j < n_kcs; ++j) {
+            for (int l = 0; l < n_ncs; ++l) {
+                for (int t = 0; t < n_threads; ++t) {
+                    GemmConfig cfg = {kernels->gemm_mr_options[i], kcs[j], ncs[l], threads[t]};
+                    double gflops = time_config(a, m, packed, c, &cfg);
+                    if (gflops > best.gflops) {
+                        best.cfg = cfg;
+                        best.gflops = (float)gflops;
+                    }
+                }
+            }
+        }
+    }
+
+    free_packed_matrix(packed);
+    free(a);
+    free(b);
+    free(c);
+    return best;
+}
+
+// Function to benchmark every shape and merge the winners into the tuning file at path
+// Entries of other hosts, tiers and shapes already in the file are kept.
+int gemm_autotune(const GemmShape* shapes, int n_shapes, const char* path) {
+    const char* cpu = cpu_model_name();
+    const char* tier = get_kernels()->name;
+    printf("Tuning %d GEMM shapes on %s (%s kernels, %d threads)\n", n_shapes, cpu, tier, get_num_threads());
+
+    TuneTable table = {0};
+    read_tuning_file(path, &table);
+
+    int n_tuned = 0;
+    for (int s = 0; s < n_shapes; ++s) {
+        int m = m_bucket(shapes[s].m);
+        int k = shapes[s].k;
+        int n = shapes[s].n;
+        int seen = 0;
+        for (int i = 0; i < s; ++i) {
+            seen |= m_bucket(shapes[i].m) == m && shapes[i].k == k && shapes[i].n == n;
+        }
+        if (seen) {
+            continue;
+        }
+
+        double heuristic_gflops = 0.0;
+        TuneEntry best = tune_shape(m, k, n, &heuristic_gflops);
+        snprintf(best.cpu, sizeof(best.cpu), "%s", cpu);
+        snprintf(best.tier, sizeof(best.tier), "%s", tier);
+        best.m = m;
+        best.k = k;
+        best.n = n;
+        table_put(&table, &best);
+        n_tuned++;
+        printf("  m=%4d k=%4d n=%4d  mr=%-2d kc=%-3d nc=%-2d threads=%d  %7.2f GFLOP/s (heuristic %7.2f, x%.2f)\n",
+               m, k, n, best.cfg.mr, best.cfg.kc, best.cfg.nc, best.cfg.threads, best.gflops,
+               heuristic_gflops, best.gflops / heuristic_gflops);
+    }
+
+    // Write next to the target and rename so readers never see a partial file
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* file = fopen(tmp_path, "w");
+    if (!file) {
+        fprintf(stderr, "Could not write GEMM tuning file %s.\n", tmp_path);
+        free(table.entries);
+        return -1;
+    }
+    fprintf(file, "%s\n", TUNING_HEADER);
+    for (int i = 0; i < table.n_entries; ++i) {
+        const TuneEntry* e = &table.entries[i];
+        fprintf(file, "%s\t%s\t%d %d %d\t%d %d %d %d\t%.2f\n", e->cpu, e->tier, e->m, e->k, e->n,
+                e->cfg.mr, e->cfg.kc, e->cfg.nc, e->cfg.threads, e->gflops);
+    }
+    int failed = fclose(file) != 0 || rename(tmp_path, path) != 0;
+    free(table.entries);
+    if (failed) {
+        fprintf(stderr, "Could not write GEMM tuning file %s.\n", path);
+        return -1;
+    }
+    printf("Wrote %d tuned shapes to %s (%d entries in total)\n", n_tuned, path, table.n_entries);
+    return 0;
+}
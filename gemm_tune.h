@@ -0,0 +1,32 @@
+#ifndef GEMM_TUNE_H
+#define GEMM_TUNE_H
+
+#include "kernels.h"
+
+// Tuning cache read at startup, overridable with GPTC_GEMM_TUNING
+#define GEMM_TUNING_FILE "gemm_tuning.txt"
+
+// Row counts are bucketed to the next power of two, capped here
+#define GEMM_TUNE_MAX_M 1024
+
+// Minimum wall time spent timing each candidate configuration
+#define GEMM_TUNE_MIN_SECONDS 0.02
+
+// One GEMM problem: C[m, n] = A[m, k] * B[k, n]
+typedef struct {
+    int m;
+    int k;
+    int n;
+} GemmShape;
+
+// Function prototypes
+const char* gemm_tuning_path(void);
+void gemm_tuning_load(void);
+void gemm_set_default_threads(int n_threads);
+GemmConfig gemm_heuristic_config(int m, int k, int n);
+GemmConfig gemm_config_for(int m, int k, int n);
+void gemm_packed_config(const float* a, int m, const PackedMatrix* b, float* c, const GemmConfig* cfg);
+void gemm_sparse_config(const float* a, int m, const SparseMatrix* b, float* c, const GemmConfig* cfg);
+int gemm_autotune(const GemmShape* shapes, int n_shapes, const char* path);
+
+#endif // GEMM_TUNE_H
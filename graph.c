@@ -0,0 +1,607 @@
+#include "graph.h"
+#include "kernels.h"
+#include "threads.h"
+#include "vmath.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// Buffer index of the node whose output goes straight into graph_run's out tensor
+#define GRAPH_EXTERNAL (-2)
+
+static const char* op_names[GOP_COUNT] = {
+    "embed", "matmul", "bmm", "bmm_nt", "concat", "stack",
+    "bias", "relu", "scale", "add", "causal_mask", "softmax", "layer_norm",
+};
+
+// Function to check whether an op only reads and writes the current row of its input
+static int is_row_op(GraphOp op) {
+    return op >= GOP_BIAS;
+}
+
+// Function to create an empty graph
+Graph* create_graph(void) {
+    Graph* g = (Graph*)calloc(1, sizeof(Graph));
+    g->output = -1;
+    return g;
+}
+
+// Function to free a graph and its planned buffers
+void free_graph(Graph* g) {
+    for (int i = 0; i < g->n_nodes; ++i) {
+        free(g->nodes[i].inputs);
+    }
+    for (int i = 0; i < g->n_buffers; ++i) {
+        free(g->buffers[i]);
+    }
+    free(g->nodes);
+    free(g->groups);
+    free(g->buffers);
+    free(g->buffer_floats);
+    free(g);
+}
+
+// Function to append a node, returning its index or -1 if an input failed to record
+static int add_node(Graph* g, GraphOp op, const int* inputs, int n_inputs, const int* shape, int n_dims) {
+    for (int i = 0; i < n_inputs; ++i) {
+        if (inputs[i] < 0 || inputs[i] >= g->n_nodes) {
+            return -1;
+        }
+    }
+    if (n_dims < 1 || n_dims > GRAPH_MAX_DIMS) {
+        fprintf(stderr, "Graph %s: %d dimensions are not supported.\n", op_names[op], n_dims);
+        return -1;
+    }
+    if (g->n_nodes == g->capacity) {
+        g->capacity = g->capacity ? g->capacity * 2 : 64;
+        g->nodes = (GraphNode*)realloc(g->nodes, g->capacity * sizeof(GraphNode));
+    }
+
+    GraphNode* node = &g->nodes[g->n_nodes];
+    memset(node, 0, sizeof(*node));
+    node->op = op;
+    node->inputs = (int*)malloc((n_inputs > 0 ? n_inputs : 1) * sizeof(int));
+    memcpy(node->inputs, inputs, n_inputs * sizeof(int));
+    node->n_inputs = n_inputs;
+    memcpy(node->shape, shape, n_dims * sizeof(int));
+    node->n_dims = n_dims;
+    node->size = 1;
+    for (int i = 0; i < n_dims; ++i) {
+        node->size *= shape[i];
+    }
+    node->group = -1;
+    node->buffer = -1;
+    return g->n_nodes++;
+}
+
+static int last_dim(const GraphNode* node) {
+    return node->shape[node->n_dims - 1];
+}
+
+// Function to record a row op with the same shape as its primary input
+static int add_row_op(Graph* g, GraphOp op, int x, const int* others, int n_others) {
+    if (x < 0 || x >= g->n_nodes) {
+        return -1;
+    }
+    int inputs[1 + n_others];
+    inputs[0] = x;
+    memcpy(inputs + 1, others, n_others * sizeof(int));
+    return add_node(g, op, inputs, 1 + n_others, g->nodes[x].shape, g->nodes[x].n_dims);
+}
+
+// Function to record the (batch, block, n_embd) token plus position embeddings
+// The token ids themselves are bound when the graph runs.
+int graph_embed(Graph* g, const Tensor* token_table, const Tensor* position_table, int batch, int block) {
+    if (block > position_table->shape[0]) {
+        fprintf(stderr, "Graph embed: block %d exceeds the %d positions.\n", block, position_table->shape[0]);
+        return -1;
+    }
+    int shape[] = {batch, block, token_table->shape[1]};
+    int node = add_node(g, GOP_EMBED, NULL, 0, shape, 3);
+    if (node >= 0) {
+        g->nodes[node].table = token_table;
+        g->nodes[node].pos_table = position_table;
+    }
+    return node;
+}
+
+// Function to record a Linear layer: a packed GEMM followed by a fusable bias add
+int graph_linear(Graph* g, Linear* layer, int x) {
+    if (x < 0) {
+        return -1;
+    }
+    const GraphNode* in = &g->nodes[x];
+    if (last_dim(in) != layer->weights->shape[0]) {
+        fprintf(stderr, "Graph linear: input ends in %d features, expected %d.\n",
+                last_dim(in), layer->weights->shape[0]);
+        return -1;
+    }
+    int shape[GRAPH_MAX_DIMS];
+    memcpy(shape, in->shape, in->n_dims * sizeof(int));
+    shape[in->n_dims - 1] = layer->weights->shape[1];
+    int mm = add_node(g, GOP_MATMUL, &x, 1, shape, in->n_dims);
+    if (mm < 0) {
+        return -1;
+    }
+    g->nodes[mm].linear = layer;
+    int bias = add_row_op(g, GOP_BIAS, mm, NULL, 0);
+    g->nodes[bias].linear = layer;
+    return bias;
+}
+
+// Function to record a LayerNorm over the last dimension
+int graph_layer_norm(Graph* g, LayerNorm* ln, int x) {
+    if (x < 0) {
+        return -1;
+    }
+    if (last_dim(&g->nodes[x]) != ln->gamma->size) {
+        fprintf(stderr, "Graph layer_norm: input does not end in %d features.\n", ln->gamma->size);
+        return -1;
+    }
+    int node = add_row_op(g, GOP_LAYER_NORM, x, NULL, 0);
+    g->nodes[node].ln = ln;
+    return node;
+}
+
+// Function to record ReLU
+int graph_relu(Graph* g, int x) {
+    return add_row_op(g, GOP_RELU, x, NULL, 0);
+}
+
+// Function to record multiplication by a constant
+int graph_scale(Graph* g, int x, float scalar) {
+    int node = add_row_op(g, GOP_SCALE, x, NULL, 0);
+    if (node >= 0) {
+        g->nodes[node].scalar = scalar;
+    }
+    return node;
+}
+
+// Function to record x + other; fusion follows x, so pass the freshly computed operand first
+int graph_add(Graph* g, int x, int other) {
+    if (x < 0 || other < 0) {
+        return -1;
+    }
+    if (g->nodes[x].size != g->nodes[other].size || last_dim(&g->nodes[x]) != last_dim(&g->nodes[other])) {
+        fprintf(stderr, "Graph add: operands have different shapes.\n");
+        return -1;
+    }
+    return add_row_op(g, GOP_ADD, x, &other, 1);
+}
+
+// Function to record a causal mask over trailing square blocks
+// The trailing matrices may stack several square blocks (e.g. the scores of a
+// graph_stack of query heads); each block is masked on its own.
+int graph_causal_mask(Graph* g, int x) {
+    if (x < 0) {
+        return -1;
+    }
+    const GraphNode* in = &g->nodes[x];
+    if (in->n_dims < 2 || in->shape[in->n_dims - 2] % in->shape[in->n_dims - 1] != 0) {
+        fprintf(stderr, "Graph causal_mask: input is not a stack of square blocks.\n");
+        return -1;
+    }
+    return add_row_op(g, GOP_CAUSAL_MASK, x, NULL, 0);
+}
+
+// Function to record a softmax over the last dimension
+int graph_softmax(Graph* g, int x) {
+    return add_row_op(g, GOP_SOFTMAX, x, NULL, 0);
+}
+
+// Function to record a[..., M, K] @ b[..., K, N] (transpose_b: b is [..., N, K])
+static int add_bmm(Graph* g, GraphOp op, int a, int b, int transpose_b) {
+    if (a < 0 || b < 0) {
+        return -1;
+    }
+    const GraphNode* na = &g->nodes[a];
+    const GraphNode* nb = &g->nodes[b];
+    int d = na->n_dims;
+    int k_b = transpose_b ? nb->shape[d - 1] : nb->shape[d - 2];
+    int ok = d >= 2 && nb->n_dims == d && na->shape[d - 1] == k_b;
+    for (int i = 0; ok && i < d - 2; ++i) {
+        ok = na->shape[i] == nb->shape[i];
+    }
+    if (!ok) {
+        fprintf(stderr, "Graph %s: operand shapes are not compatible.\n", op_names[op]);
+        return -1;
+    }
+    int shape[GRAPH_MAX_DIMS];
+    memcpy(shape, na->shape, d * sizeof(int));
+    shape[d - 1] = transpose_b ? nb->shape[d - 2] : nb->shape[d - 1];
+    int inputs[] = {a, b};
+    return add_node(g, op, inputs, 2, shape, d);
+}
+
+// Function to record a batched matrix product
+int graph_bmm(Graph* g, int a, int b) {
+    return add_bmm(g, GOP_BMM, a, b, 0);
+}
+
+// Function to record a batched product with the transpose of b
+int graph_bmm_nt(Graph* g, int a, int b) {
+    return add_bmm(g, GOP_BMM_NT, a, b, 1);
+}
+
+// Function to record a concatenation along the last dimension
+// Each input's second-to-last dimension stacks blocks row blocks per leading index
+// (as graph_stack records them); every block becomes its own column slice, in order.
+int graph_concat(Graph* g, const int* xs, int n, int blocks) {
+    if (n < 1 || xs[0] < 0 || blocks < 1) {
+        return -1;
+    }
+    const GraphNode* first = &g->nodes[xs[0]];
+    if (first->n_dims < 2 || first->shape[first->n_dims - 2] % blocks != 0) {
+        fprintf(stderr, "Graph concat: inputs do not stack %d row blocks.\n", blocks);
+        return -1;
+    }
+    int shape[GRAPH_MAX_DIMS];
+    memcpy(shape, first->shape, first->n_dims * sizeof(int));
+    shape[first->n_dims - 2] /= blocks;
+    shape[first->n_dims - 1] = 0;
+    for (int i = 0; i < n; ++i) {
+        if (xs[i] < 0) {
+            return -1;
+        }
+        const GraphNode* in = &g->nodes[xs[i]];
+        if (in->n_dims != first->n_dims || in->size / last_dim(in) != first->size / last_dim(first)) {
+            fprintf(stderr, "Graph concat: inputs have different leading shapes.\n");
+            return -1;
+        }
+        shape[first->n_dims - 1] += blocks * last_dim(in);
+    }
+    int node = add_node(g, GOP_CONCAT, xs, n, shape, first->n_dims);
+    if (node >= 0) {
+        g->nodes[node].blocks = blocks;
+    }
+    return node;
+}
+
+// Function to record same-shape inputs stacked along the second-to-last dimension
+// Per leading index, input t's rows form block t, so e.g. the query heads sharing
+// a key/value group become one operand for a single batched product.
+int graph_stack(Graph* g, const int* xs, int n) {
+    if (n < 1 || xs[0] < 0) {
+        return -1;
+    }
+    const GraphNode* first = &g->nodes[xs[0]];
+    for (int i = 0; i < n; ++i) {
+        if (xs[i] < 0) {
+            return -1;
+        }
+        const GraphNode* in = &g->nodes[xs[i]];
+        if (in->n_dims < 2 || in->n_dims != first->n_dims ||
+            memcmp(in->shape, first->shape, first->n_dims * sizeof(int)) != 0) {
+            fprintf(stderr, "Graph stack: inputs have different shapes.\n");
+            return -1;
+        }
+    }
+    int shape[GRAPH_MAX_DIMS];
+    memcpy(shape, first->shape, first->n_dims * sizeof(int));
+    shape[first->n_dims - 2] *= n;
+    return add_node(g, GOP_STACK, xs, n, shape, first->n_dims);
+}
+
+// Fusion pass: a row op joins the group of the node recorded just before it when
+// it reads that node, so e.g. GEMM -> bias -> residual add -> LayerNorm becomes one
+// group that runs tile by tile instead of four full passes over the activations
+static void fuse_groups(Graph* g) {
+    g->groups = (GraphGroup*)malloc(g->n_nodes * sizeof(GraphGroup));
+    g->n_groups = 0;
+    for (int i = 0; i < g->n_nodes; ++i) {
+        GraphNode* node = &g->nodes[i];
+        if (i > 0 && is_row_op(node->op) && node->inputs[0] == i - 1) {
+            node->group = g->n_groups - 1;
+            g->groups[node->group].last = i;
+            continue;
+        }
+        GraphGroup* group = &g->groups[g->n_groups];
+        group->first = i;
+        group->last = i;
+        group->rows = (int)(node->size / last_dim(node));
+        node->group = g->n_groups++;
+    }
+}
+
+// Function to decide which outputs are stored and to assign them buffers
+// Anything read other than by the next op of its fused chain is materialized;
+// the rest of a chain works in place in the storage of the next materialized
+// node. Buffers are recycled once the last group reading them has run.
+static void plan_buffers(Graph* g) {
+    int n = g->n_nodes;
+    int* external = (int*)calloc(n, sizeof(int));
+    int* last_use = (int*)malloc(n * sizeof(int));
+    for (int i = 0; i < n; ++i) {
+        last_use[i] = g->nodes[i].group;
+    }
+    for (int c = 0; c < n; ++c) {
+        const GraphNode* consumer = &g->nodes[c];
+        for (int t = 0; t < consumer->n_inputs; ++t) {
+            int in = consumer->inputs[t];
+            int chained = t == 0 && c == in + 1 && consumer->group == g->nodes[in].group;
+            if (!chained) {
+                external[in]++;
+            }
+            if (consumer->group > last_use[in]) {
+                last_use[in] = consumer->group;
+            }
+        }
+    }
+
+    int* owner = (int*)malloc(n * sizeof(int));
+    int* in_use = (int*)calloc(n, sizeof(int));
+    g->buffer_floats = (size_t*)calloc(n, sizeof(size_t));
+    g->n_buffers = 0;
+
+    for (int gi = 0; gi < g->n_groups; ++gi) {
+        const GraphGroup* group = &g->groups[gi];
+        for (int b = 0; b < g->n_buffers; ++b) {
+            if (in_use[b] && last_use[owner[b]] < gi) {
+                in_use[b] = 0;
+            }
+        }
+
+        for (int i = group->first; i <= group->last; ++i) {
+            GraphNode* node = &g->nodes[i];
+            node->materialized = external[i] > 0 || i == g->output || i == group->last;
+            if (!node->materialized) {
+                continue;
+            }
+            if (i == g->output) {
+                node->buffer = GRAPH_EXTERNAL;
+                continue;
+            }
+            // Best fit among free buffers, else grow the largest free one, else a new one
+            int best = -1;
+            for (int b = 0; b < g->n_buffers; ++b) {
+                if (in_use[b]) {
+                    continue;
+                }
+                int fits = g->buffer_floats[b] >= node->size;
+                int best_fits = best >= 0 && g->buffer_floats[best] >= node->size;
+                if (best < 0 || (fits && (!best_fits || g->buffer_floats[b] < g->buffer_floats[best])) ||
+                    (!fits && !best_fits && g->buffer_floats[b] > g->buffer_floats[best])) {
+                    best = b;
+                }
+            }
+            if (best < 0) {
+                best = g->n_buffers++;
+            }
+            if (g->buffer_floats[best] < node->size) {
+                g->buffer_floats[best] = node->size;
+            }
+            in_use[best] = 1;
+            owner[best] = i;
+            node->buffer = best;
+        }
+
+        int storage = GRAPH_EXTERNAL;
+        for (int i = group->last; i >= group->first; --i) {
+            if (g->nodes[i].materialized) {
+                storage = g->nodes[i].buffer;
+            } else {
+                g->nodes[i].buffer = storage;
+            }
+        }
+    }
+
+    g->buffers = (float**)malloc((g->n_buffers > 0 ? g->n_buffers : 1) * sizeof(float*));
+    for (int b = 0; b < g->n_buffers; ++b) {
+        g->buffers[b] = (float*)malloc(g->buffer_floats[b] * sizeof(float));
+    }
+
+    free(external);
+    free(last_use);
+    free(owner);
+    free(in_use);
+}
+
+// Function to fuse the recorded ops and plan their buffers, with output as the result
+int graph_compile(Graph* g, int output) {
+    if (output < 0 || output >= g->n_nodes) {
+        fprintf(stderr, "Graph compile: invalid output node.\n");
+        return -1;
+    }
+    if (g->groups) {
+        fprintf(stderr, "Graph compile: graph is already compiled.\n");
+        return -1;
+    }
+    g->output = output;
+    fuse_groups(g);
+    plan_buffers(g);
+    return 0;
+}
+
+// Function to get the storage of a node's output during graph_run
+static float* node_data(const Graph* g, int i) {
+    int buffer = g->nodes[i].buffer;
+    return buffer == GRAPH_EXTERNAL ? g->output_data : g->buffers[buffer];
+}
+
+// Function to wrap a node's storage in a borrowed tensor (shape copied into shape_buf)
+static Tensor node_tensor(const Graph* g, int i, int* shape_buf) {
+    const GraphNode* node = &g->nodes[i];
+    memcpy(shape_buf, node->shape, node->n_dims * sizeof(int));
+    return tensor_view(node_data(g, i), shape_buf, node->n_dims);
+}
+
+// Function to run a head op that needs whole matrices (batched products)
+static void run_whole(const Graph* g, int i) {
+    const GraphNode* node = &g->nodes[i];
+    int out_shape[GRAPH_MAX_DIMS], a_shape[GRAPH_MAX_DIMS], b_shape[GRAPH_MAX_DIMS];
+    Tensor out = node_tensor(g, i, out_shape);
+    Tensor a = node_tensor(g, node->inputs[0], a_shape);
+    Tensor b = node_tensor(g, node->inputs[1], b_shape);
+    if (node->op == GOP_BMM_NT) {
+        bmm_transposed_into(&out, &a, &b);
+    } else {
+        bmm_into(&out, &a, &b);
+    }
+}
+
+// Function to run one op on rows [r0, r0 + rows) of its output
+// Row ops may run in place (dst == src): every kernel used here allows aliasing.
+static void run_rows(const Graph* g, int i, int r0, int rows) {
+    const GraphNode* node = &g->nodes[i];
+    const KernelTable* kernels = get_kernels();
+    int width = last_dim(node);
+    float* dst = node_data(g, i) + (size_t)r0 * width;
+    const float* src = NULL;
+    if (node->n_inputs > 0) {
+        src = node_data(g, node->inputs[0]) + (size_t)r0 * last_dim(&g->nodes[node->inputs[0]]);
+    }
+    int n = rows * width;
+
+    switch (node->op) {
+    case GOP_EMBED: {
+        int block = node->shape[1];
+        for (int r = r0; r < r0 + rows; ++r) {
+            int token = (int)g->idx->data[r];
+            const float* tok = node->table->data + (size_t)token * width;
+            const float* pos = node->pos_table->data + (size_t)(r % block) * width;
+            kernels->vec_add(dst + (size_t)(r - r0) * width, tok, pos, width);
+        }
+        break;
+    }
+    case GOP_MATMUL:
+        linear_matmul_rows(node->linear, src, rows, dst);
+        break;
+    case GOP_CONCAT: {
+        // Output row r is row i of leading index r / block_rows; block b of an
+        // input holds it at row (r / block_rows * blocks + b) * block_rows + i
+        int block_rows = node->shape[node->n_dims - 2];
+        int col = 0;
+        for (int t = 0; t < node->n_inputs; ++t) {
+            int in_width = last_dim(&g->nodes[node->inputs[t]]);
+            const float* in = node_data(g, node->inputs[t]);
+            for (int b = 0; b < node->blocks; ++b) {
+                for (int r = r0; r < r0 + rows; ++r) {
+                    size_t in_row = ((size_t)(r / block_rows) * node->blocks + b) * block_rows + r % block_rows;
+                    memcpy(dst + (size_t)(r - r0) * width + col, in + in_row * in_width, in_width * sizeof(float));
+                }
+                col += in_width;
+            }
+        }
+        break;
+    }
+    case GOP_STACK: {
+        // Output row r is row i of block t at leading index r / (n_inputs * block_rows)
+        int block_rows = g->nodes[node->inputs[0]].shape[node->n_dims - 2];
+        for (int r = r0; r < r0 + rows; ++r) {
+            int t = r / block_rows % node->n_inputs;
+            size_t in_row = (size_t)(r / (block_rows * node->n_inputs)) * block_rows + r % block_rows;
+            memcpy(dst + (size_t)(r - r0) * width, node_data(g, node->inputs[t]) + in_row * width, width * sizeof(float));
+        }
+        break;
+    }
+    case GOP_BIAS:
+        for (int r = 0; r < rows; ++r) {
+            kernels->vec_add(dst + (size_t)r * width, src + (size_t)r * width, node->linear->bias->data, width);
+        }
+        break;
+    case GOP_ADD:
+        kernels->vec_add(dst, src, node_data(g, node->inputs[1]) + (size_t)r0 * width, n);
+        break;
+    case GOP_LAYER_NORM:
+        for (int r = 0; r < rows; ++r) {
+            row_layer_norm(dst + (size_t)r * width, src + (size_t)r * width, node->ln->gamma->data,
+                           node->ln->beta->data, width, node->ln->epsilon);
+        }
+        break;
+    default:
+        // The remaining row ops are in-place kernels
+        if (dst != src) {
+            memcpy(dst, src, n * sizeof(float));
+        }
+        if (node->op == GOP_RELU) {
+            row_relu(dst, n);
+        } else if (node->op == GOP_SCALE) {
+            kernels->vec_scale(dst, node->scalar, n);
+        } else if (node->op == GOP_SOFTMAX) {
+            for (int r = 0; r < rows; ++r) {
+                row_softmax(dst + (size_t)r * width, width);
+            }
+        } else if (node->op == GOP_CAUSAL_MASK) {
+            for (int r = 0; r < rows; ++r) {
+                int query = (r0 + r) % width;
+                for (int j = query + 1; j < width; ++j) {
+                    dst[(size_t)r * width + j] = -INFINITY;
+                }
+            }
+        }
+        break;
+    }
+}
+
+// Tiles of one group handed to parallel_for
+typedef struct {
+    const Graph* g;
+    const GraphGroup* group;
+    int first_tiled;
+} GroupJob;
+
+static void group_tile_task(int tile, void* ctx) {
+    GroupJob* job = (GroupJob*)ctx;
+    int r0 = tile * GRAPH_ROW_TILE;
+    int rows = (job->group->rows - r0 < GRAPH_ROW_TILE) ? (job->group->rows - r0) : GRAPH_ROW_TILE;
+    for (int i = job->first_tiled; i <= job->group->last; ++i) {
+        run_rows(job->g, i, r0, rows);
+    }
+}
+
+// Function to run the compiled graph on (batch, block) token ids, writing the output into out
+int graph_run(Graph* g, const Tensor* idx, Tensor* out) {
+    if (!g->groups) {
+        fprintf(stderr, "Graph run: graph is not compiled.\n");
+        return -1;
+    }
+    for (int i = 0; i < g->n_nodes; ++i) {
+        const GraphNode* node = &g->nodes[i];
+        if (node->op == GOP_EMBED && (!idx || (size_t)idx->size != node->size / last_dim(node))) {
+            fprintf(stderr, "Graph run: expected %d token ids.\n", (int)(node->size / last_dim(node)));
+            return -1;
+        }
+    }
+
+    const GraphNode* output = &g->nodes[g->output];
+    resize_tensor(out, output->shape, output->n_dims);
+    g->idx = idx;
+    g->output_data = out->data;
+
+    for (int gi = 0; gi < g->n_groups; ++gi) {
+        GroupJob job = {g, &g->groups[gi], g->groups[gi].first};
+        GraphOp head = g->nodes[job.first_tiled].op;
+        if (head == GOP_BMM || head == GOP_BMM_NT) {
+            run_whole(g, job.first_tiled++);
+        }
+        if (job.first_tiled <= job.group->last) {
+            parallel_for((job.group->rows + GRAPH_ROW_TILE - 1) / GRAPH_ROW_TILE, group_tile_task, &job);
+        }
+    }
+
+    g->idx = NULL;
+    g->output_data = NULL;
+    return 0;
+}
+
+// Function to print how the recorded ops were fused and how much memory they use
+void print_graph_summary(const Graph* g) {
+    int n_materialized = 0;
+    int n_fused = 0;
+    size_t unfused_floats = 0;
+    for (int i = 0; i < g->n_nodes; ++i) {
+        n_materialized += g->nodes[i].materialized;
+        unfused_floats += g->nodes[i].size;
+    }
+    for (int gi = 0; gi < g->n_groups; ++gi) {
+        n_fused += g->groups[gi].last > g->groups[gi].first;
+    }
+    size_t planned_floats = 0;
+    for (int b = 0; b < g->n_buffers; ++b) {
+        planned_floats += g->buffer_floats[b];
+    }
+    fprintf(stderr, "Graph: %d ops in %d groups (%d fused), %d stored outputs, %.1f MiB of buffers "
+            "(%.1f MiB if every op output were kept)\n",
+            g->n_nodes, g->n_groups, n_fused, n_materialized,
+            planned_floats * sizeof(float) / 1048576.0, unfused_floats * sizeof(float) / 1048576.0);
+}
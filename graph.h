@@ -0,0 +1,95 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stddef.h>
+#include "tensor.h"
+#include "linear.h"
+#include "layer_norm.h"
+
+// Rows per tile of a fused group: the group's head op and all of its fused
+// row ops run on one tile while it is in cache, tiles spread over threads
+#define GRAPH_ROW_TILE 32
+#define GRAPH_MAX_DIMS 4
+
+// Operators a graph can record
+typedef enum {
+    GOP_EMBED,       // Token plus position embedding rows of the bound token ids
+    GOP_MATMUL,      // x @ Linear weights (packed GEMM), without the bias
+    GOP_BMM,         // Batched a @ b over the leading dimensions
+    GOP_BMM_NT,      // Batched a @ b^T over the leading dimensions
+    GOP_CONCAT,      // Concatenation along the last dimension, unstacking GOP_STACK row blocks
+    GOP_STACK,       // Inputs' matrices stacked along the second-to-last dimension
+    // Row-local ops: fused into the group of the node they read
+    GOP_BIAS,        // x + Linear bias
+    GOP_RELU,
+    GOP_SCALE,       // x * scalar
+    GOP_ADD,         // x + other (same shape)
+    GOP_CAUSAL_MASK, // -inf above the diagonal of every trailing square block
+    GOP_SOFTMAX,     // Softmax of every row
+    GOP_LAYER_NORM,
+    GOP_COUNT
+} GraphOp;
+
+// One recorded operation; its output is referred to by the node index
+typedef struct {
+    GraphOp op;
+    int* inputs; // inputs[0] is the primary input that fusion follows
+    int n_inputs;
+    int shape[GRAPH_MAX_DIMS];
+    int n_dims;
+    size_t size;
+    Linear* linear;          // GOP_MATMUL, GOP_BIAS
+    LayerNorm* ln;           // GOP_LAYER_NORM
+    const Tensor* table;     // GOP_EMBED token and position tables
+    const Tensor* pos_table;
+    float scalar;            // GOP_SCALE
+    int blocks;              // GOP_CONCAT row blocks per input
+    // Filled by graph_compile
+    int group;
+    int materialized; // Output is stored because something outside the fused chain reads it
+    int buffer;       // Storage index (see graph.c), shared along a fused chain
+} GraphNode;
+
+// A run of nodes executed as one loop nest: a head op followed by fused row ops
+typedef struct {
+    int first;
+    int last;
+    int rows;
+} GraphGroup;
+
+// A recorded forward pass for one input shape, compiled to fused groups
+// Running a graph reuses its planned buffers, so one graph serves one caller at a time.
+typedef struct {
+    GraphNode* nodes;
+    int n_nodes;
+    int capacity;
+    GraphGroup* groups;
+    int n_groups;
+    float** buffers;
+    size_t* buffer_floats;
+    int n_buffers;
+    int output;
+    const Tensor* idx;  // Token ids bound by graph_run
+    float* output_data; // Caller's output storage bound by graph_run
+} Graph;
+
+// Function prototypes
+Graph* create_graph(void);
+void free_graph(Graph* g);
+int graph_embed(Graph* g, const Tensor* token_table, const Tensor* position_table, int batch, int block);
+int graph_linear(Graph* g, Linear* layer, int x);
+int graph_layer_norm(Graph* g, LayerNorm* ln, int x);
+int graph_relu(Graph* g, int x);
+int graph_scale(Graph* g, int x, float scalar);
+int graph_add(Graph* g, int x, int other);
+int graph_causal_mask(Graph* g, int x);
+int graph_softmax(Graph* g, int x);
+int graph_bmm(Graph* g, int a, int b);
+int graph_bmm_nt(Graph* g, int a, int b);
+int graph_concat(Graph* g, const int* xs, int n, int blocks);
+int graph_stack(Graph* g, const int* xs, int n);
+int graph_compile(Graph* g, int output);
+int graph_run(Graph* g, const Tensor* idx, Tensor* out);
+void print_graph_summary(const Graph* g);
+
+#endif // GRAPH_H
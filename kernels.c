@@ -0,0 +1,71 @@
+#include "kernels.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+extern const KernelTable kernels_scalar;
+extern const KernelTable kernels_sse;
+#if defined(__x86_64__) || defined(__i386__)
+extern const KernelTable kernels_avx2;
+extern const KernelTable kernels_avx512;
+#endif
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static const KernelTable* active_kernels = NULL;
+static CpuTier active_tier = CPU_TIER_SCALAR;
+
+// Function to get the table compiled for a tier (NULL if not built for this arch)
+const KernelTable* get_kernel_table(CpuTier tier) {
+    switch (tier) {
+    case CPU_TIER_SCALAR:
+        return &kernels_scalar;
+    case CPU_TIER_SSE:
+        return &kernels_sse;
+#if defined(__x86_64__) || defined(__i386__)
+    case CPU_TIER_AVX2:
+        return &kernels_avx2;
+    case CPU_TIER_AVX512:
+        return &kernels_avx512;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+// Function to detect the CPU, apply GPTC_CPU_TIER and log the choice
+static void init_kernels(void) {
+    CpuTier detected = cpu_detect_tier();
+    CpuTier tier = detected;
+
+    const char* forced = getenv("GPTC_CPU_TIER");
+    if (forced) {
+        int requested = cpu_tier_from_name(forced);
+        if (requested < 0) {
+            fprintf(stderr, "Unknown GPTC_CPU_TIER '%s', ignoring it.\n", forced);
+        } else if ((CpuTier)requested > detected) {
+            fprintf(stderr, "GPTC_CPU_TIER=%s is not supported by this CPU, using %s.\n",
+                    forced, cpu_tier_name(detected));
+        } else {
+            tier = (CpuTier)requested;
+        }
+    }
+
+    while (!get_kernel_table(tier)) {
+        tier = (CpuTier)(tier - 1);
+    }
+    active_tier = tier;
+    active_kernels = get_kernel_table(tier);
+    fprintf(stderr, "Kernels: %s (best supported: %s)\n", cpu_tier_name(tier), cpu_tier_name(detected));
+}
+
+// Function to get the active kernel table
+const KernelTable* get_kernels(void) {
+    pthread_once(&kernels_once, init_kernels);
+    return active_kernels;
+}
+
+// Function to get the tier of the active kernel table
+CpuTier get_kernel_tier(void) {
+    pthread_once(&kernels_once, init_kernels);
+    return active_tier;
+}
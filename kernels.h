@@ -0,0 +1,50 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "tensor.h"
+#include "cpu_features.h"
+
+// Largest register tile height any tier compiles a GEMM micro-kernel for
+#define GEMM_MR_MAX 16
+
+// Blocking of one packed GEMM (see gemm_tune.h for how it is chosen)
+typedef struct {
+    int mr;      // Rows of A per micro-kernel call (one of the tier's gemm_mr_options)
+    int kc;      // Depth of a K block; C is accumulated over blocks (<= 0 means all of K)
+    int nc;      // Column panels per block, reused across all row tiles (<= 0 means all)
+    int threads; // Row-parallel split across threads (1 means the calling thread only)
+} GemmConfig;
+
+// Hot kernels, one table per instruction-set tier (see kernels_impl.h)
+typedef struct {
+    const char* name;
+    void (*vec_exp)(float* y, const float* x, int n);
+    void (*vec_log)(float* y, const float* x, int n);
+    void (*vec_rsqrt)(float* y, const float* x, int n);
+    void (*vec_tanh)(float* y, const float* x, int n);
+    void (*vec_gelu)(float* y, const float* x, int n);
+    void (*vec_add)(float* y, const float* a, const float* b, int n);
+    void (*vec_scale)(float* x, float s, int n);
+    void (*vec_relu)(float* x, int n);
+    float (*row_max)(const float* x, int n);
+    float (*row_sum_exp)(const float* x, int n, float shift);
+    void (*row_exp_shift)(float* x, int n, float shift);
+    void (*row_softmax)(float* x, int n);
+    void (*row_layer_norm)(float* y, const float* x, const float* gamma, const float* beta, int n, float epsilon);
+    void (*gemm_packed)(const float* a, int m, const PackedMatrix* b, float* c, const GemmConfig* cfg);
+    void (*attention_group)(const float* q, int ldq, int n_q, const float* k, const float* v, int ld,
+                            int n_visible, int head_size, float scale, float* wei, float* out);
+    void (*gemm_sparse)(const float* a, int m, const SparseMatrix* b, float* c, int p0, int p1);
+    const int* gemm_mr_options; // Register tile heights with a compiled micro-kernel
+    int n_gemm_mr_options;
+    int gemm_default_mr;
+} KernelTable;
+
+// Function prototypes
+// The active table is chosen once, on first use: the best tier the CPU supports,
+// or the tier named by GPTC_CPU_TIER (scalar, sse, avx2, avx512) if it is lower.
+const KernelTable* get_kernels(void);
+const KernelTable* get_kernel_table(CpuTier tier);
+CpuTier get_kernel_tier(void);
+
+#endif // KERNELS_H
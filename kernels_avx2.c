@@ -0,0 +1,17 @@
+// 256-bit kernels for CPUs with AVX2 and FMA, selected at runtime by kernels.c
+#if defined(__x86_64__) || defined(__i386__)
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include "kernels.h"
+#include "vmath.h"
+
+#pragma GCC target("avx2,fma")
+
+#define KERNEL_TABLE kernels_avx2
+#define KERNEL_TIER_NAME "avx2"
+#define VLEN 8
+#define KERNEL_MR 4
+#define KERNEL_MR_LIST(X) X(2) X(4) X(6)
+#include "kernels_impl.h"
+#endif
@@ -0,0 +1,17 @@
+// 512-bit kernels for CPUs with AVX-512 F/DQ/VL, selected at runtime by kernels.c
+#if defined(__x86_64__) || defined(__i386__)
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include "kernels.h"
+#include "vmath.h"
+
+#pragma GCC target("avx512f,avx512dq,avx512vl,avx2,fma")
+
+#define KERNEL_TABLE kernels_avx512
+#define KERNEL_TIER_NAME "avx512"
+#define VLEN 16
+#define KERNEL_MR 8
+#define KERNEL_MR_LIST(X) X(4) X(8) X(12)
+#include "kernels_impl.h"
+#endif
@@ -0,0 +1,701 @@
+// Kernel template, included once per instruction-set tier by kernels_<tier>.c
+//
+// The including file defines:
+//   KERNEL_TABLE      name of the exported KernelTable
+//   KERNEL_TIER_NAME  printable tier name
+//   VLEN              floats per vector (1, 4, 8 or 16)
+//   KERNEL_MR         default rows of A per GEMM micro-kernel call
+//   KERNEL_MR_LIST(X) X(mr) for every micro-kernel height to compile (including
+//                     KERNEL_MR, none above GEMM_MR_MAX); the autotuner picks among them
+// and may set a #pragma GCC target before including this file, so the same
+// vector-extension code is compiled to scalar, SSE, AVX2 or AVX-512 instructions.
+// Everything here is the fast path; vmath.c handles strict mode.
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include "kernels.h"
+#include "vmath.h"
+#include "threads.h"
+
+typedef float VF __attribute__((vector_size(VLEN * sizeof(float))));
+typedef int VI __attribute__((vector_size(VLEN * sizeof(int))));
+
+#define NR_VECS (GEMM_NR / VLEN)
+
+// Helpers to load/store possibly unaligned vectors
+static inline VF load_v(const float* p) {
+    VF v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store_v(float* p, VF v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline VF splat(float f) {
+    return (VF){0} + f;
+}
+
+// Lane-wise select: mask lanes are -1 (take a) or 0 (take b)
+static inline VF select_v(VI mask, VF a, VF b) {
+    return (VF)((mask & (VI)a) | (~mask & (VI)b));
+}
+
+static inline float hsum_v(VF v) {
+    float sum = 0.0f;
+    for (int i = 0; i < VLEN; ++i) {
+        sum += v[i];
+    }
+    return sum;
+}
+
+// exp(x): x = n * ln2 + r with |r| <= ln2 / 2, exp(r) by a degree-6 polynomial,
+// 2^n assembled directly in the exponent bits
+static inline VF exp_v(VF x) {
+    const float exp_hi = 88.7228391f;
+    const float exp_lo = -87.3365448f;
+    VI overflow = x > splat(exp_hi);
+    VI underflow = x < splat(exp_lo);
+    x = select_v(overflow, splat(exp_hi), x);
+    x = select_v(underflow, splat(exp_lo), x);
+
+    VF fx = x * 1.44269504088896341f + 0.5f;
+    VI n = __builtin_convertvector(fx, VI);
+    n += (VI)(__builtin_convertvector(n, VF) > fx); // floor for negative fx
+    VF nf = __builtin_convertvector(n, VF);
+    x = x - nf * 0.693359375f - nf * -2.12194440e-4f;
+
+    VF z = x * x;
+    VF y = splat(1.9875691500e-4f);
+    y = y * x + 1.3981999507e-3f;
+    y = y * x + 8.3334519073e-3f;
+    y = y * x + 4.1665795894e-2f;
+    y = y * x + 1.6666665459e-1f;
+    y = y * x + 5.0000001201e-1f;
+    y = y * z + x + 1.0f;
+
+    // 2^n as two factors so n = 128 and n = -126 stay representable
+    VI n1 = n >> 1;
+    y = y * (VF)((n1 + 127) << 23) * (VF)((n - n1 + 127) << 23);
+    y = select_v(overflow, splat(INFINITY), y);
+    return select_v(underflow, splat(0.0f), y);
+}
+
+// log(x): x = m * 2^e with m in [sqrt(1/2), sqrt(2)), log(m) by a degree-9 polynomial
+static inline VF log_v(VF x) {
+    VI zero = x == splat(0.0f);
+    VI negative = x < splat(0.0f);
+    VI infinite = x == splat(INFINITY);
+    x = select_v(x < splat(FLT_MIN), splat(FLT_MIN), x);
+
+    VI bits = (VI)x;
+    VI e = ((bits >> 23) & 0xff) - 126;
+    VF m = (VF)((bits & 0x007fffff) | 0x3f000000); // mantissa in [0.5, 1)
+
+    VI small = m < splat(0.707106781186547524f);
+    e += small; // e - 1 where m was small
+    m = m + (VF)(small & (VI)m) - 1.0f;
+    VF ef = __builtin_convertvector(e, VF);
+
+    VF z = m * m;
+    VF y = splat(7.0376836292e-2f);
+    y = y * m - 1.1514610310e-1f;
+    y = y * m + 1.1676998740e-1f;
+    y = y * m - 1.2420140846e-1f;
+    y = y * m + 1.4249322787e-1f;
+    y = y * m - 1.6668057665e-1f;
+    y = y * m + 2.0000714765e-1f;
+    y = y * m - 2.4999993993e-1f;
+    y = y * m + 3.3333331174e-1f;
+    y = y * m * z;
+    y += ef * -2.12194440e-4f;
+    y += z * -0.5f;
+    y = m + y + ef * 0.693359375f;
+
+    y = select_v(zero, splat(-INFINITY), y);
+    y = select_v(negative, splat(NAN), y);
+    return select_v(infinite, splat(INFINITY), y);
+}
+
+// 1/sqrt(x): bit-level initial guess refined by three Newton-Raphson steps
+static inline VF rsqrt_v(VF x) {
+    VF y = (VF)(0x5f375a86 - ((VI)x >> 1));
+    VF half_x = x * 0.5f;
+    y = y * (1.5f - half_x * y * y);
+    y = y * (1.5f - half_x * y * y);
+    y = y * (1.5f - half_x * y * y);
+    return y;
+}
+
+// tanh(x): odd polynomial for |x| < 0.625, 1 - 2 / (exp(2|x|) + 1) elsewhere
+static inline VF tanh_v(VF x) {
+    VI sign = (VI)x & (int)0x80000000u;
+    VF ax = (VF)((VI)x & ~sign);
+
+    VF z = x * x;
+    VF p = splat(-5.70498872745e-3f);
+    p = p * z + 2.06390887954e-2f;
+    p = p * z - 5.37397155531e-2f;
+    p = p * z + 1.33314422036e-1f;
+    p = p * z - 3.33332819422e-1f;
+    VF small = p * z * x + x;
+
+    VF large = 1.0f - 2.0f / (exp_v(ax + ax) + 1.0f);
+    large = (VF)((VI)large | sign);
+    return select_v(ax < splat(0.625f), small, large);
+}
+
+// GELU with the tanh approximation used by GPT-2
+static inline VF gelu_v(VF x) {
+    VF inner = 0.7978845608028654f * (x + 0.044715f * x * x * x);
+    return 0.5f * x * (1.0f + tanh_v(inner));
+}
+
+// Apply a vector kernel over n elements; the tail is padded through a temporary
+#define KERNEL_MAP(NAME, KERNEL)                                      \
+    static void NAME(float* y, const float* x, int n) {               \
+        int i = 0;                                                    \
+        for (; i + VLEN <= n; i += VLEN) {                            \
+            store_v(y + i, KERNEL(load_v(x + i)));                    \
+        }                                                             \
+        if (i < n) {                                                  \
+            float tmp[VLEN] = {0};                                    \
+            memcpy(tmp, x + i, (n - i) * sizeof(float));              \
+            store_v(tmp, KERNEL(load_v(tmp)));                        \
+            memcpy(y + i, tmp, (n - i) * sizeof(float));              \
+        }                                                             \
+    }
+
+KERNEL_MAP(k_vec_exp, exp_v)
+KERNEL_MAP(k_vec_log, log_v)
+KERNEL_MAP(k_vec_rsqrt, rsqrt_v)
+KERNEL_MAP(k_vec_tanh, tanh_v)
+KERNEL_MAP(k_vec_gelu, gelu_v)
+
+static void k_vec_add(float* y, const float* a, const float* b, int n) {
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        store_v(y + i, load_v(a + i) + load_v(b + i));
+    }
+    for (; i < n; ++i) {
+        y[i] = a[i] + b[i];
+    }
+}
+
+static void k_vec_scale(float* x, float s, int n) {
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        store_v(x + i, load_v(x + i) * s);
+    }
+    for (; i < n; ++i) {
+        x[i] *= s;
+    }
+}
+
+static void k_vec_relu(float* x, int n) {
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        VF v = load_v(x + i);
+        store_v(x + i, select_v(v > splat(0.0f), v, splat(0.0f)));
+    }
+    for (; i < n; ++i) {
+        x[i] = (x[i] > 0.0f) ? x[i] : 0.0f;
+    }
+}
+
+static float k_row_max(const float* x, int n) {
+    float max_val = -INFINITY;
+    int i = 0;
+    if (n >= VLEN) {
+        VF m = load_v(x);
+        for (i = VLEN; i + VLEN <= n; i += VLEN) {
+            VF v = load_v(x + i);
+            m = select_v(v > m, v, m);
+        }
+        for (int j = 0; j < VLEN; ++j) {
+            if (m[j] > max_val) {
+                max_val = m[j];
+            }
+        }
+    }
+    for (; i < n; ++i) {
+        if (x[i] > max_val) {
+            max_val = x[i];
+        }
+    }
+    return max_val;
+}
+
+static float k_row_sum_exp(const float* x, int n, float shift) {
+    VF acc = splat(0.0f);
+    VF s = splat(shift);
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        acc += exp_v(load_v(x + i) - s);
+    }
+    if (i < n) {
+        float tmp[VLEN];
+        for (int j = 0; j < VLEN; ++j) {
+            tmp[j] = (i + j < n) ? x[i + j] : -INFINITY;
+        }
+        acc += exp_v(load_v(tmp) - s);
+    }
+    return hsum_v(acc);
+}
+
+static void k_row_exp_shift(float* x, int n, float shift) {
+    VF s = splat(shift);
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        store_v(x + i, exp_v(load_v(x + i) - s));
+    }
+    if (i < n) {
+        float tmp[VLEN] = {0};
+        memcpy(tmp, x + i, (n - i) * sizeof(float));
+        store_v(tmp, exp_v(load_v(tmp) - s));
+        memcpy(x + i, tmp, (n - i) * sizeof(float));
+    }
+}
+
+static void k_row_softmax(float* x, int n) {
+    float max_val = k_row_max(x, n);
+    k_row_exp_shift(x, n, max_val);
+    VF acc = splat(0.0f);
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        acc += load_v(x + i);
+    }
+    float sum = hsum_v(acc);
+    for (; i < n; ++i) {
+        sum += x[i];
+    }
+    k_vec_scale(x, 1.0f / sum, n);
+}
+
+static void k_row_layer_norm(float* y, const float* x, const float* gamma, const float* beta, int n, float epsilon) {
+    VF acc = splat(0.0f);
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        acc += load_v(x + i);
+    }
+    float sum = hsum_v(acc);
+    for (; i < n; ++i) {
+        sum += x[i];
+    }
+    float mean = sum / n;
+
+    VF vmean = splat(mean);
+    acc = splat(0.0f);
+    for (i = 0; i + VLEN <= n; i += VLEN) {
+        VF d = load_v(x + i) - vmean;
+        acc += d * d;
+    }
+    float sum_sq = hsum_v(acc);
+    for (; i < n; ++i) {
+        float d = x[i] - mean;
+        sum_sq += d * d;
+    }
+    float rstd = rsqrt_v(splat(sum_sq / n + epsilon))[0];
+
+    VF vrstd = splat(rstd);
+    for (i = 0; i + VLEN <= n; i += VLEN) {
+        store_v(y + i, (load_v(x + i) - vmean) * vrstd * load_v(gamma + i) + load_v(beta + i));
+    }
+    for (; i < n; ++i) {
+        y[i] = (x[i] - mean) * rstd * gamma[i] + beta[i];
+    }
+}
+
+// GEMM micro-kernel: C[mr, nr] = A[mr, k] * panel[k, GEMM_NR], or += when accumulate is set
+// MR is a compile-time constant in every instantiation below, so acc stays in registers.
+// Rows past mr are computed from row 0 and discarded so the loops stay fixed-size.
+static inline __attribute__((always_inline)) void gemm_micro(const int MR, int mr, int nr, int k,
+                                                             const float* a, int lda, const float* panel,
+                                                             float* c, int ldc, int accumulate) {
+    const float* a_rows[GEMM_MR_MAX];
+    for (int i = 0; i < MR; ++i) {
+        a_rows[i] = a + (size_t)((i < mr) ? i : 0) * lda;
+    }
+
+    VF acc[GEMM_MR_MAX][NR_VECS];
+    for (int i = 0; i < MR; ++i) {
+        for (int v = 0; v < NR_VECS; ++v) {
+            acc[i][v] = splat(0.0f);
+        }
+    }
+
+    for (int p = 0; p < k; ++p) {
+        VF b[NR_VECS];
+#pragma GCC unroll 16
+        for (int v = 0; v < NR_VECS; ++v) {
+            b[v] = load_v(panel + (size_t)p * GEMM_NR + v * VLEN);
+        }
+#pragma GCC unroll 16
+        for (int i = 0; i < MR; ++i) {
+            VF a_val = splat(a_rows[i][p]);
+#pragma GCC unroll 16
+            for (int v = 0; v < NR_VECS; ++v) {
+                acc[i][v] += a_val * b[v];
+            }
+        }
+    }
+
+    for (int i = 0; i < mr; ++i) {
+        float* c_row = c + (size_t)i * ldc;
+        if (nr == GEMM_NR) {
+            for (int v = 0; v < NR_VECS; ++v) {
+                VF out = accumulate ? load_v(c_row + v * VLEN) + acc[i][v] : acc[i][v];
+                store_v(c_row + v * VLEN, out);
+            }
+        } else {
+            float tmp[GEMM_NR];
+            for (int v = 0; v < NR_VECS; ++v) {
+                store_v(tmp + v * VLEN, acc[i][v]);
+            }
+            for (int j = 0; j < nr; ++j) {
+                c_row[j] = accumulate ? c_row[j] + tmp[j] : tmp[j];
+            }
+        }
+    }
+}
+
+typedef void (*GemmMicroFn)(int mr, int nr, int k, const float* a, int lda, const float* panel,
+                            float* c, int ldc, int accumulate);
+
+#define DEFINE_GEMM_MICRO(MR)                                                                    \
+    static void k_gemm_micro_##MR(int mr, int nr, int k, const float* a, int lda,                \
+                                  const float* panel, float* c, int ldc, int accumulate) {      \
+        gemm_micro(MR, mr, nr, k, a, lda, panel, c, ldc, accumulate);                           \
+    }
+KERNEL_MR_LIST(DEFINE_GEMM_MICRO)
+
+#define GEMM_MR_VALUE(MR) MR,
+#define GEMM_MR_FN(MR) k_gemm_micro_##MR,
+static const int gemm_mr_options[] = {KERNEL_MR_LIST(GEMM_MR_VALUE)};
+static const GemmMicroFn gemm_micro_fns[] = {KERNEL_MR_LIST(GEMM_MR_FN)};
+#define N_GEMM_MR_OPTIONS ((int)(sizeof(gemm_mr_options) / sizeof(gemm_mr_options[0])))
+
+// C[m, n] = A[m, k] * packed B, blocked as cfg says (NULL: KERNEL_MR rows, no blocking)
+// Loop order: K blocks, then blocks of nc panels (kept hot in cache), then row tiles.
+static void k_gemm_packed(const float* a, int m, const PackedMatrix* b, float* c, const GemmConfig* cfg) {
+    int k = b->k;
+    int n = b->n;
+    int n_panels = (n + GEMM_NR - 1) / GEMM_NR;
+    int kc = (cfg && cfg->kc > 0 && cfg->kc < k) ? cfg->kc : k;
+    int nc = (cfg && cfg->nc > 0 && cfg->nc < n_panels) ? cfg->nc : n_panels;
+
+    // Unknown heights (e.g. a cache written on another tier) fall back to KERNEL_MR
+    int want = cfg ? cfg->mr : KERNEL_MR;
+    int mr = 0;
+    GemmMicroFn micro = NULL;
+    for (int i = 0; i < N_GEMM_MR_OPTIONS; ++i) {
+        if (gemm_mr_options[i] == want || (!micro && gemm_mr_options[i] == KERNEL_MR)) {
+            mr = gemm_mr_options[i];
+            micro = gemm_micro_fns[i];
+        }
+    }
+
+    for (int k0 = 0; k0 < k; k0 += kc) {
+        int kb = (k - k0 < kc) ? (k - k0) : kc;
+        for (int p0 = 0; p0 < n_panels; p0 += nc) {
+            int p1 = (p0 + nc < n_panels) ? (p0 + nc) : n_panels;
+            for (int i0 = 0; i0 < m; i0 += mr) {
+                int rows = (m - i0 < mr) ? (m - i0) : mr;
+                for (int p = p0; p < p1; ++p) {
+                    int j0 = p * GEMM_NR;
+                    int nr = (n - j0 < GEMM_NR) ? (n - j0) : GEMM_NR;
+                    micro(rows, nr, kb, a + (size_t)i0 * k + k0, k,
+                          b->data + (size_t)p * k * GEMM_NR + (size_t)k0 * GEMM_NR,
+                          c + (size_t)i0 * n + j0, n, k0 > 0);
+                }
+            }
+        }
+    }
+}
+
+// Tiling of the 2:4 sparse GEMM: SPARSE_ROWS rows of A times SPARSE_KC of its
+// columns are transposed into an L1-resident tile; each kept weight is then one
+// broadcast times SPARSE_VECS vectors of rows
+#define SPARSE_VECS 2
+#define SPARSE_ROWS (SPARSE_VECS * VLEN)
+#define SPARSE_KC 256
+
+// Rows of A the few-row sparse path carries through one pass over B (fewer with
+// only 16 vector registers), and the independent accumulators per vector of
+// columns that hide the FMA latency
+#if VLEN >= 16
+#define SPARSE_FEW_ROWS 4
+#else
+#define SPARSE_FEW_ROWS 2
+#endif
+#define SPARSE_CHAINS 4
+
+// Largest m that takes the few-row path instead of transposed tiles of SPARSE_ROWS
+#define SPARSE_FEW_MAX 8
+
+// Per-thread buffer for sparse GEMM tiles
+static ThreadBuffer sparse_tile_buffer = THREAD_BUFFER_INIT;
+
+// The column-vectorized path needs a variable lane permute (AVX2 and up)
+#if VLEN >= 8
+typedef unsigned char VB __attribute__((vector_size(VLEN)));
+
+// One panel of the few-row sparse GEMM for ROWS rows of A (rows of them real)
+// ROWS is a compile-time constant in every call, so acc stays in registers; rows
+// past `rows` are computed from row 0 and discarded, as in gemm_micro. One load
+// brings kept value j of VLEN columns, and a lane permute picks for every column
+// the A entry its 2-bit position selects.
+static inline __attribute__((always_inline)) void sparse_panel(const int ROWS, int rows, const float* a, int k,
+                                                               const float* values, const uint8_t* indices,
+                                                               float* c, int ldc, int nr) {
+    const int CHAINS = (SPARSE_CHAINS / ROWS > 0) ? SPARSE_CHAINS / ROWS : 1;
+    const float* a_rows[SPARSE_FEW_ROWS];
+    for (int r = 0; r < ROWS; ++r) {
+        a_rows[r] = a + (size_t)((r < rows) ? r : 0) * k;
+    }
+
+    VF acc[SPARSE_CHAINS][SPARSE_FEW_ROWS][NR_VECS];
+    for (int t = 0; t < CHAINS; ++t) {
+        for (int r = 0; r < ROWS; ++r) {
+            for (int v = 0; v < NR_VECS; ++v) {
+                acc[t][r][v] = splat(0.0f);
+            }
+        }
+    }
+
+    for (int j = 0; j < k / 2; j += 4) {
+        // Entries 2j .. 2j + 7 of each A row: the two groups holding kept values j .. j + 3
+        VF x[SPARSE_FEW_ROWS];
+        for (int r = 0; r < ROWS; ++r) {
+            x[r] = splat(0.0f);
+            memcpy(&x[r], a_rows[r] + 2 * j, 8 * sizeof(float));
+        }
+        const float* w_row = values + (size_t)j * GEMM_NR;
+        const uint8_t* idx_row = indices + (size_t)(j / 4) * GEMM_NR;
+#pragma GCC unroll 4
+        for (int v = 0; v < NR_VECS; ++v) {
+            VB raw;
+            memcpy(&raw, idx_row + v * VLEN, sizeof(raw));
+            VI bits = __builtin_convertvector(raw, VI);
+#pragma GCC unroll 4
+            for (int t = 0; t < 4; ++t) {
+                VI sel = ((bits >> (2 * t)) & 3) + 4 * (t / 2);
+                VF w = load_v(w_row + (size_t)t * GEMM_NR + v * VLEN);
+#pragma GCC unroll 4
+                for (int r = 0; r < ROWS; ++r) {
+                    acc[t % CHAINS][r][v] += w * __builtin_shuffle(x[r], sel);
+                }
+            }
+        }
+    }
+
+    for (int r = 0; r < rows; ++r) {
+        float tmp[GEMM_NR];
+        for (int v = 0; v < NR_VECS; ++v) {
+            VF sum = acc[0][r][v];
+            for (int t = 1; t < CHAINS; ++t) {
+                sum += acc[t][r][v];
+            }
+            store_v(tmp + v * VLEN, sum);
+        }
+        memcpy(c + (size_t)r * ldc, tmp, nr * sizeof(float));
+    }
+}
+#endif
+
+// 2:4 sparse GEMM over panels [p0, p1) of B, for a few rows of A
+// Vectorized across the columns of a panel (see sparse_panel); the scalar and SSE
+// tiers gather the kept entries column by column.
+static void sparse_few_rows(const float* a, int m, const SparseMatrix* b, float* c, int p0, int p1) {
+    int k = b->k;
+    int n = b->n;
+    int kept = k / 2;
+
+    for (int i0 = 0; i0 < m; i0 += SPARSE_FEW_ROWS) {
+        int rows = (m - i0 < SPARSE_FEW_ROWS) ? (m - i0) : SPARSE_FEW_ROWS;
+        const float* a_rows = a + (size_t)i0 * k;
+        for (int p = p0; p < p1; ++p) {
+            const float* values = b->values + (size_t)p * kept * GEMM_NR;
+            const uint8_t* indices = b->indices + (size_t)p * (kept / 4) * GEMM_NR;
+            int j0 = p * GEMM_NR;
+            int nr = (n - j0 < GEMM_NR) ? (n - j0) : GEMM_NR;
+            float* c_rows = c + (size_t)i0 * n + j0;
+#if VLEN >= 8
+            if (rows == 1) {
+                sparse_panel(1, rows, a_rows, k, values, indices, c_rows, n, nr);
+            } else if (rows == 2 || SPARSE_FEW_ROWS == 2) {
+                sparse_panel(2, rows, a_rows, k, values, indices, c_rows, n, nr);
+            } else {
+                sparse_panel(SPARSE_FEW_ROWS, rows, a_rows, k, values, indices, c_rows, n, nr);
+            }
+#else
+            for (int r = 0; r < rows; ++r) {
+                const float* x = a_rows + (size_t)r * k;
+                for (int lane = 0; lane < nr; ++lane) {
+                    float s0 = 0.0f, s1 = 0.0f;
+                    for (int j = 0; j < kept; j += 4) {
+                        unsigned bits = indices[(size_t)(j / 4) * GEMM_NR + lane];
+                        const float* w = values + (size_t)j * GEMM_NR + lane;
+                        const float* group = x + 2 * j;
+                        s0 += w[0] * group[bits & 3] + w[GEMM_NR] * group[(bits >> 2) & 3];
+                        s1 += w[2 * GEMM_NR] * group[4 + ((bits >> 4) & 3)] + w[3 * GEMM_NR] * group[4 + (bits >> 6)];
+                    }
+                    c_rows[(size_t)r * n + lane] = s0 + s1;
+                }
+            }
+#endif
+        }
+    }
+}
+
+// 2:4 sparse GEMM: C[m, n] = A[m, k] * B over panels [p0, p1) of B, touching only the kept half
+// Per row tile and K block, A is transposed to xt[k][SPARSE_ROWS] so the kept
+// weight of row r of B multiplies the contiguous vector of tile rows at xt[r];
+// partial sums of every column accumulate in ct[n][SPARSE_ROWS] across K blocks.
+// With only a few rows (where most tile lanes would be padding), or if the tile
+// cannot be allocated, sparse_few_rows vectorizes across columns instead.
+static void k_gemm_sparse(const float* a, int m, const SparseMatrix* b, float* c, int p0, int p1) {
+    int k = b->k;
+    int n = b->n;
+    int kept = k / 2;
+    int col0 = p0 * GEMM_NR;
+    int col1 = (p1 * GEMM_NR < n) ? p1 * GEMM_NR : n;
+
+    float* xt = NULL;
+    if (m > SPARSE_FEW_MAX) {
+        xt = thread_buffer(&sparse_tile_buffer, (size_t)(SPARSE_KC + col1 - col0) * SPARSE_ROWS);
+    }
+    if (!xt) {
+        sparse_few_rows(a, m, b, c, p0, p1);
+        return;
+    }
+    float* ct = xt + (size_t)SPARSE_KC * SPARSE_ROWS;
+    for (int r0 = 0; r0 < m; r0 += SPARSE_ROWS) {
+        int rows = (m - r0 < SPARSE_ROWS) ? (m - r0) : SPARSE_ROWS;
+        for (int k0 = 0; k0 < k; k0 += SPARSE_KC) {
+            int kb = (k - k0 < SPARSE_KC) ? (k - k0) : SPARSE_KC; // A multiple of 8, as k is
+            for (int p = 0; p < kb; ++p) {
+                float* dst = xt + (size_t)p * SPARSE_ROWS;
+                for (int r = 0; r < rows; ++r) {
+                    dst[r] = a[(size_t)(r0 + r) * k + k0 + p];
+                }
+                for (int r = rows; r < SPARSE_ROWS; ++r) {
+                    dst[r] = 0.0f;
+                }
+            }
+
+            for (int col = col0; col < col1; ++col) {
+                // Entries of one column are GEMM_NR apart within its panel
+                size_t panel = col / GEMM_NR;
+                int lane = col % GEMM_NR;
+                const float* values = b->values + (panel * kept + k0 / 2) * GEMM_NR + lane;
+                const uint8_t* indices = b->indices + (panel * (kept / 4) + k0 / 8) * GEMM_NR + lane;
+                float* partial = ct + (size_t)(col - col0) * SPARSE_ROWS;
+                VF acc[2][SPARSE_VECS];
+                for (int v = 0; v < SPARSE_VECS; ++v) {
+                    acc[0][v] = (k0 == 0) ? splat(0.0f) : load_v(partial + v * VLEN);
+                    acc[1][v] = splat(0.0f);
+                }
+                for (int j = 0; j < kb / 2; j += 4) {
+                    unsigned bits = indices[(size_t)(j / 4) * GEMM_NR];
+                    const float* w = values + (size_t)j * GEMM_NR;
+                    const float* group = xt + (size_t)(2 * j) * SPARSE_ROWS;
+                    const float* x0 = group + (bits & 3) * SPARSE_ROWS;
+                    const float* x1 = group + ((bits >> 2) & 3) * SPARSE_ROWS;
+                    const float* x2 = group + (4 + ((bits >> 4) & 3)) * SPARSE_ROWS;
+                    const float* x3 = group + (4 + (bits >> 6)) * SPARSE_ROWS;
+                    VF w0 = splat(w[0]), w1 = splat(w[GEMM_NR]);
+                    VF w2 = splat(w[2 * GEMM_NR]), w3 = splat(w[3 * GEMM_NR]);
+#pragma GCC unroll 4
+                    for (int v = 0; v < SPARSE_VECS; ++v) {
+                        acc[0][v] += w0 * load_v(x0 + v * VLEN) + w1 * load_v(x1 + v * VLEN);
+                        acc[1][v] += w2 * load_v(x2 + v * VLEN) + w3 * load_v(x3 + v * VLEN);
+                    }
+                }
+                for (int v = 0; v < SPARSE_VECS; ++v) {
+                    store_v(partial + v * VLEN, acc[0][v] + acc[1][v]);
+                }
+            }
+        }
+
+        for (int r = 0; r < rows; ++r) {
+            float* c_row = c + (size_t)(r0 + r) * n;
+            for (int col = col0; col < col1; ++col) {
+                c_row[col] = ct[(size_t)(col - col0) * SPARSE_ROWS + r];
+            }
+        }
+    }
+}
+
+static inline float dot_v(const float* a, const float* b, int n) {
+    VF acc = splat(0.0f);
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        acc += load_v(a + i) * load_v(b + i);
+    }
+    float sum = hsum_v(acc);
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Query rows of n_q heads that share one key/value head, at one position, attending
+// causally over n_visible cached keys/values
+// Query r starts at q + r * ldq; k and v rows are ld floats apart. Each key and
+// value row is loaded once and applied to every query of the group while it is in
+// registers/L1. wei is scratch of n_q * n_visible floats and out (n_q rows of
+// head_size floats) is accumulated into. The softmax goes through vmath so strict
+// mode is honoured.
+static void k_attention_group(const float* q, int ldq, int n_q, const float* k, const float* v, int ld,
+                              int n_visible, int head_size, float scale, float* wei, float* out) {
+    for (int j = 0; j < n_visible; ++j) {
+        const float* k_row = k + (size_t)j * ld;
+        for (int r = 0; r < n_q; ++r) {
+            wei[(size_t)r * n_visible + j] = dot_v(q + (size_t)r * ldq, k_row, head_size) * scale;
+        }
+    }
+    for (int r = 0; r < n_q; ++r) {
+        row_softmax(wei + (size_t)r * n_visible, n_visible);
+    }
+    for (int j = 0; j < n_visible; ++j) {
+        const float* v_row = v + (size_t)j * ld;
+        for (int r = 0; r < n_q; ++r) {
+            float w = wei[(size_t)r * n_visible + j];
+            float* o = out + (size_t)r * head_size;
+            VF p = splat(w);
+            int d = 0;
+            for (; d + VLEN <= head_size; d += VLEN) {
+                store_v(o + d, load_v(o + d) + p * load_v(v_row + d));
+            }
+            for (; d < head_size; ++d) {
+                o[d] += w * v_row[d];
+            }
+        }
+    }
+}
+
+const KernelTable KERNEL_TABLE = {
+    KERNEL_TIER_NAME,
+    k_vec_exp,
+    k_vec_log,
+    k_vec_rsqrt,
+    k_vec_tanh,
+    k_vec_gelu,
+    k_vec_add,
+    k_vec_scale,
+    k_vec_relu,
+    k_row_max,
+    k_row_sum_exp,
+    k_row_exp_shift,
+    k_row_softmax,
+    k_row_layer_norm,
+    k_gemm_packed,
+    k_attention_group,
+    k_gemm_sparse,
+    gemm_mr_options,
+    N_GEMM_MR_OPTIONS,
+    KERNEL_MR,
+};
@@ -0,0 +1,9 @@
+// Scalar reference kernels: one float per "vector" and no auto-vectorization
+#pragma GCC optimize("no-tree-vectorize")
+
+#define KERNEL_TABLE kernels_scalar
+#define KERNEL_TIER_NAME "scalar"
+#define VLEN 1
+#define KERNEL_MR 1
+#define KERNEL_MR_LIST(X) X(1) X(2) X(4)
+#include "kernels_impl.h"
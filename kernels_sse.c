@@ -0,0 +1,7 @@
+// 128-bit kernels: SSE2 on x86-64 (the baseline ABI), the native 128-bit SIMD elsewhere
+#define KERNEL_TABLE kernels_sse
+#define KERNEL_TIER_NAME "sse"
+#define VLEN 4
+#define KERNEL_MR 2
+#define KERNEL_MR_LIST(X) X(1) X(2) X(3)
+#include "kernels_impl.h"
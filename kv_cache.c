@@ -0,0 +1,46 @@
+#include "kv_cache.h"
+#include <stdlib.h>
+
+// Function to create an empty KV cache
+// group_size is the number of query heads sharing each key/value head.
+KVCache* create_kv_cache(int n_layers, int kv_dim, int group_size, int capacity) {
+    KVCache* cache = (KVCache*)malloc(sizeof(KVCache));
+    cache->n_layers = n_layers;
+    cache->kv_dim = kv_dim;
+    cache->capacity = capacity;
+    cache->len = 0;
+    cache->workspace = create_workspace();
+    // Attention scores of a query group grow with the sequence; reserve them once for the longest one
+    workspace_matrix(cache->workspace, WS_SCORES, group_size, capacity);
+    cache->k = (float**)malloc(n_layers * sizeof(float*));
+    cache->v = (float**)malloc(n_layers * sizeof(float*));
+    for (int i = 0; i < n_layers; ++i) {
+        cache->k[i] = (float*)malloc((size_t)capacity * kv_dim * sizeof(float));
+        cache->v[i] = (float*)malloc((size_t)capacity * kv_dim * sizeof(float));
+    }
+    return cache;
+}
+
+// Function to free a KV cache
+void free_kv_cache(KVCache* cache) {
+    for (int i = 0; i < cache->n_layers; ++i) {
+        free(cache->k[i]);
+        free(cache->v[i]);
+    }
+    free(cache->k);
+    free(cache->v);
+    free_workspace(cache->workspace);
+    free(cache);
+}
+
+// Function to forget every stored position
+void reset_kv_cache(KVCache* cache) {
+    cache->len = 0;
+}
+
+// Function to drop every stored position from len onwards
+void truncate_kv_cache(KVCache* cache, int len) {
+    if (len < cache->len) {
+        cache->len = (len > 0) ? len : 0;
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef KV_CACHE_H
+#define KV_CACHE_H
+
+#include "workspace.h"
+
+// Attention keys and values of every layer for positions [0, len) of one sequence
+// Each layer stores [capacity, kv_dim] rows, kv_dim = n_kv_heads * head_size; key/value
+// head g owns columns [g * head_size, (g + 1) * head_size) and is shared by every
+// query head of its group.
+typedef struct {
+    float** k;    // Per-layer keys
+    float** v;    // Per-layer values
+    int n_layers;
+    int kv_dim;   // Floats per cached key (or value) row
+    int capacity; // Maximum number of positions (the model's block_size)
+    int len;      // Number of positions currently stored
+    Workspace* workspace; // Scratch buffers of forward passes over this sequence
+} KVCache;
+
+// Function prototypes
+KVCache* create_kv_cache(int n_layers, int kv_dim, int group_size, int capacity);
+void free_kv_cache(KVCache* cache);
+void reset_kv_cache(KVCache* cache);
+void truncate_kv_cache(KVCache* cache, int len);
+
+#endif // KV_CACHE_H
@@ -1,4 +1,5 @@
 #include "layer_norm.h"
+#include "vmath.h"
 #include <math.h>
 #include <stdio.h>
 
@@ -25,40 +26,31 @@ void free_layer_norm(LayerNorm* ln) {
     free(ln);
 }
 
-// Forward pass for Layer Normalization
-Tensor* layer_norm_forward(LayerNorm* ln, const Tensor* input) {
-    // Assuming input is 2D (batch_size, features)
-    if (input->n_dims != 2) {
-        fprintf(stderr, "LayerNorm currently only supports 2D tensors.\n");
-        return NULL;
+// Forward pass for Layer Normalization into out
+// input is [..., features]; every leading index is normalized as one row.
+int layer_norm_forward_into(LayerNorm* ln, const Tensor* input, Tensor* out) {
+    int features = ln->gamma->size;
+    if (input->n_dims < 1 || input->shape[input->n_dims - 1] != features) {
+        fprintf(stderr, "LayerNorm input does not end in %d features.\n", features);
+        return -1;
     }
+    int batch_size = input->size / features;
 
-    int batch_size = input->shape[0];
-    int features = input->shape[1];
-
-    Tensor* output = create_tensor(input->shape, input->n_dims);
+    resize_tensor(out, input->shape, input->n_dims);
 
     for (int i = 0; i < batch_size; ++i) {
-        float sum = 0.0f;
-        float sum_sq = 0.0f;
-        for (int j = 0; j < features; ++j) {
-            int indices[] = {i, j};
-            float val = get_tensor_value(input, indices);
-            sum += val;
-            sum_sq += val * val;
-        }
-
-        float mean = sum / features;
-        float variance = (sum_sq / features) - (mean * mean);
-        float std_dev = sqrtf(variance + ln->epsilon);
+        row_layer_norm(out->data + (size_t)i * features, input->data + (size_t)i * features,
+                       ln->gamma->data, ln->beta->data, features, ln->epsilon);
+    }
+    return 0;
+}
 
-        for (int j = 0; j < features; ++j) {
-            int indices[] = {i, j};
-            float val = get_tensor_value(input, indices);
-            float normalized_val = (val - mean) / std_dev;
-            float scaled_shifted_val = normalized_val * ln->gamma->data[j] + ln->beta->data[j];
-            set_tensor_value(output, indices, scaled_shifted_val);
-        }
+// Forward pass for Layer Normalization
+Tensor* layer_norm_forward(LayerNorm* ln, const Tensor* input) {
+    Tensor* output = create_tensor(input->shape, input->n_dims);
+    if (layer_norm_forward_into(ln, input, output) != 0) {
+        free_tensor(output);
+        return NULL;
     }
     return output;
 }
@@ -14,5 +14,6 @@ typedef struct {
 LayerNorm* create_layer_norm(int normalized_shape);
 void free_layer_norm(LayerNorm* ln);
 Tensor* layer_norm_forward(LayerNorm* ln, const Tensor* input);
+int layer_norm_forward_into(LayerNorm* ln, const Tensor* input, Tensor* out);
 
 #endif // LAYER_NORM_H
@@ -1,5 +1,7 @@
 #include "linear.h"
+#include <math.h>
 #include <stdlib.h>
+#include "rng.h"
 
 // Function to create a new Linear layer
 Linear* create_linear_layer(int in_features, int out_features) {
@@ -11,37 +13,147 @@ Linear* create_linear_layer(int in_features, int out_features) {
     int bias_shape[] = {out_features};
     layer->bias = create_tensor(bias_shape, 1);
 
-    // Initialize weights and biases (e.g., with random values)
-    // For simplicity, we'll initialize with small constant values for now
-    for (int i = 0; i < layer->weights->size; ++i) {
-        layer->weights->data[i] = 0.1f;
-    }
-    for (int i = 0; i < layer->bias->size; ++i) {
-        layer->bias->data[i] = 0.01f;
-    }
+    // Initialize weights and biases uniformly in [-1/sqrt(in), 1/sqrt(in)]
+    // Each layer gets its own init stream; the bias continues after the weights.
+    float bound = 1.0f / sqrtf((float)in_features);
+    RngStream rng = rng_stream(RNG_INIT, rng_next_stream_id(RNG_INIT));
+    rng_fill_uniform_parallel(&rng, layer->weights->data, layer->weights->size, -bound, bound);
+    rng_seek(&rng, layer->weights->size);
+    rng_fill_uniform_parallel(&rng, layer->bias->data, layer->bias->size, -bound, bound);
+
+    layer->packed_weights = NULL;
+    layer->prepack = 1;
+    layer->sparse_weights = NULL;
 
     return layer;
 }
 
+// Function to free the packed copy of the weights, if any
+static void drop_packed_weights(Linear* layer) {
+    PackedMatrix* packed = __atomic_exchange_n(&layer->packed_weights, NULL, __ATOMIC_ACQ_REL);
+    if (packed) {
+        free_packed_matrix(packed);
+    }
+}
+
 // Function to free a Linear layer
 void free_linear_layer(Linear* layer) {
+    if (layer->sparse_weights) {
+        free_sparse_matrix(layer->sparse_weights);
+    }
+    drop_packed_weights(layer);
     free_tensor(layer->weights);
     free_tensor(layer->bias);
     free(layer);
 }
 
-// Function to perform the forward pass of the Linear layer
-Tensor* linear_forward(const Linear* layer, const Tensor* input) {
-    Tensor* output = matmul(input, layer->weights);
-    if (output) {
-        // Add bias
-        for (int i = 0; i < output->shape[0]; ++i) {
-            for (int j = 0; j < output->shape[1]; ++j) {
-                int indices[] = {i, j};
-                float current_value = get_tensor_value(output, indices);
-                set_tensor_value(output, indices, current_value + layer->bias->data[j]);
-            }
+// Function to drop the packed copy of the weights
+// Must be called after writing to layer->weights so the next forward repacks them.
+// A pruned layer is re-pruned to 2:4 by magnitude, so it stays sparse.
+void linear_weights_changed(Linear* layer) {
+    drop_packed_weights(layer);
+    if (layer->sparse_weights) {
+        free_sparse_matrix(layer->sparse_weights);
+        layer->sparse_weights = compress_2_4(layer->weights->data, layer->weights->shape[0],
+                                             layer->weights->shape[1]);
+    }
+}
+
+// Function to get the packed weights, packing them once on first use
+// Concurrent first calls may both pack; one copy wins and the other is freed.
+PackedMatrix* linear_packed_weights(Linear* layer) {
+    PackedMatrix* packed = __atomic_load_n(&layer->packed_weights, __ATOMIC_ACQUIRE);
+    if (packed) {
+        return packed;
+    }
+    packed = pack_matrix(layer->weights->data, layer->weights->shape[0], layer->weights->shape[1]);
+    PackedMatrix* expected = NULL;
+    if (!__atomic_compare_exchange_n(&layer->packed_weights, &expected, packed, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free_packed_matrix(packed);
+        packed = expected;
+    }
+    return packed;
+}
+
+// Function to compute out[rows, out_features] = x[rows, in_features] @ weights, without the bias
+// Takes the same dense, packed or sparse path as linear_forward_into.
+void linear_matmul_rows(Linear* layer, const float* x, int rows, float* out) {
+    if (layer->sparse_weights) {
+        gemm_sparse(x, rows, layer->sparse_weights, out);
+    } else if (layer->prepack) {
+        gemm_packed(x, rows, linear_packed_weights(layer), out);
+    } else {
+        // Borrowed views; out already has exactly the result's size, so nothing is reallocated
+        int x_shape[] = {rows, layer->weights->shape[0]};
+        int out_shape[] = {rows, layer->weights->shape[1]};
+        Tensor x_view = tensor_view((float*)x, x_shape, 2);
+        Tensor out_view = tensor_view(out, out_shape, 2);
+        matmul_into(&out_view, &x_view, layer->weights);
+    }
+}
+
+// Function to check whether a layer's weights have the shape 2:4 compression needs
+int linear_can_prune_2_4(const Linear* layer) {
+    return layer->weights->shape[0] % 8 == 0;
+}
+
+// Function to magnitude-prune the weights to 2:4 sparsity and switch to the sparse GEMM
+// The dropped weights are zeroed in layer->weights as well, so every path agrees.
+int linear_prune_2_4(Linear* layer) {
+    SparseMatrix* sparse = compress_2_4(layer->weights->data, layer->weights->shape[0], layer->weights->shape[1]);
+    if (!sparse) {
+        return -1;
+    }
+    if (layer->sparse_weights) {
+        free_sparse_matrix(layer->sparse_weights);
+    }
+    layer->sparse_weights = sparse;
+    // Pruning zeroed weights, so the dense packed copy is stale as well
+    drop_packed_weights(layer);
+    return 0;
+}
+
+// Function to get the bytes of weight storage a forward pass reads (dense or 2:4)
+size_t linear_weight_bytes(const Linear* layer) {
+    if (layer->sparse_weights) {
+        return sparse_matrix_bytes(layer->sparse_weights);
+    }
+    return (size_t)layer->weights->size * sizeof(float);
+}
+
+// Function to perform the forward pass of the Linear layer into out
+// input is [..., in_features] and out becomes [..., out_features]; leading
+// dimensions are treated as rows in place, without reshape copies.
+int linear_forward_into(Linear* layer, const Tensor* input, Tensor* out) {
+    int rc;
+    if (layer->sparse_weights) {
+        rc = matmul_sparse_into(out, input, layer->sparse_weights);
+    } else {
+        rc = layer->prepack ? matmul_packed_into(out, input, linear_packed_weights(layer))
+                            : matmul_into(out, input, layer->weights);
+    }
+    if (rc != 0) {
+        return rc;
+    }
+    // Add bias
+    int out_features = out->shape[out->n_dims - 1];
+    int rows = out->size / out_features;
+    for (int i = 0; i < rows; ++i) {
+        float* row = out->data + (size_t)i * out_features;
+        for (int j = 0; j < out_features; ++j) {
+            row[j] += layer->bias->data[j];
         }
     }
+    return 0;
+}
+
+// Function to perform the forward pass of the Linear layer
+Tensor* linear_forward(Linear* layer, const Tensor* input) {
+    Tensor* output = create_tensor(input->shape, input->n_dims);
+    if (linear_forward_into(layer, input, output) != 0) {
+        free_tensor(output);
+        return NULL;
+    }
     return output;
 }
@@ -7,11 +7,21 @@
 typedef struct {
     Tensor* weights;
     Tensor* bias;
+    PackedMatrix* packed_weights; // GEMM panel copy of weights, built on first forward
+    int prepack;                  // Keep packed_weights between calls (constant weights)
+    SparseMatrix* sparse_weights; // 2:4 compressed weights once pruned, used instead of dense
 } Linear;
 
 // Function prototypes for the Linear layer
 Linear* create_linear_layer(int in_features, int out_features);
 void free_linear_layer(Linear* layer);
-Tensor* linear_forward(const Linear* layer, const Tensor* input);
+Tensor* linear_forward(Linear* layer, const Tensor* input);
+int linear_forward_into(Linear* layer, const Tensor* input, Tensor* out);
+void linear_weights_changed(Linear* layer);
+PackedMatrix* linear_packed_weights(Linear* layer);
+void linear_matmul_rows(Linear* layer, const float* x, int rows, float* out);
+int linear_can_prune_2_4(const Linear* layer);
+int linear_prune_2_4(Linear* layer);
+size_t linear_weight_bytes(const Linear* layer);
 
 #endif // LINEAR_H
@@ -0,0 +1,165 @@
+#include "loadgen.h"
+#include "protocol.h"
+#include "threads.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct {
+    const char* socket_path;
+    const char* prompt;
+    int max_new_tokens;
+    int n_requests;
+    atomic_int next;      // Next request index to issue
+    float* latencies;     // Client-observed latency (ms) per request
+    float* first_token;   // Client-observed time to the first streamed token (ms)
+    float* queue_ms;      // Server-reported queueing delay per request
+    long n_tokens;
+    int n_errors;
+    pthread_mutex_t lock;
+} LoadGen;
+
+static int compare_floats(const void* a, const void* b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+// Function to connect to the inference server, returning the socket or -1
+int connect_to_server(const char* socket_path) {
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Failed to create socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("Failed to connect to server");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Client thread: issues requests over its own connection until all are taken
+static void* loadgen_worker(void* arg) {
+    LoadGen* lg = (LoadGen*)arg;
+    int fd = connect_to_server(lg->socket_path);
+    if (fd < 0) {
+        return NULL;
+    }
+    for (int i = atomic_fetch_add(&lg->next, 1); i < lg->n_requests; i = atomic_fetch_add(&lg->next, 1)) {
+        GenRequest request = {MSG_GENERATE_STREAM, (uint32_t)lg->max_new_tokens, 1.0f, 0, 1, (uint32_t)i, (char*)lg->prompt};
+        GenResponse response;
+        double start = now_seconds() * 1e3;
+        int failed = send_request(fd, &request) != 0;
+        // Streamed tokens arrive first, the final response closes the request
+        while (!failed) {
+            if (recv_response(fd, &response) != 0) {
+                failed = 1;
+                break;
+            }
+            if (response.status != STATUS_TOKEN) {
+                break;
+            }
+            if (lg->first_token[i] == 0.0f) {
+                lg->first_token[i] = now_seconds() * 1e3 - start;
+            }
+            free(response.text);
+        }
+        if (failed) {
+            pthread_mutex_lock(&lg->lock);
+            lg->n_errors++;
+            pthread_mutex_unlock(&lg->lock);
+            break;
+        }
+        lg->latencies[i] = now_seconds() * 1e3 - start;
+        lg->queue_ms[i] = response.queue_ms;
+        pthread_mutex_lock(&lg->lock);
+        if (response.status == STATUS_OK) {
+            lg->n_tokens += response.n_tokens;
+        } else {
+            lg->n_errors++;
+        }
+        pthread_mutex_unlock(&lg->lock);
+        free(response.text);
+    }
+    close(fd);
+    return NULL;
+}
+
+// Function to drive a running server with concurrent clients and report
+// throughput and latency percentiles. Each request uses its index as the
+// sampling seed, so runs are repeatable.
+int run_loadgen(const char* socket_path, const char* prompt, int n_requests, int concurrency, int max_new_tokens) {
+    if (n_requests < 1 || concurrency < 1) {
+        fprintf(stderr, "Invalid load: %d requests, concurrency %d\n", n_requests, concurrency);
+        return -1;
+    }
+
+    LoadGen lg;
+    memset(&lg, 0, sizeof(lg));
+    lg.socket_path = socket_path;
+    lg.prompt = prompt;
+    lg.max_new_tokens = max_new_tokens;
+    lg.n_requests = n_requests;
+    atomic_init(&lg.next, 0);
+    lg.latencies = (float*)calloc(n_requests, sizeof(float));
+    lg.queue_ms = (float*)calloc(n_requests, sizeof(float));
+    lg.first_token = (float*)calloc(n_requests, sizeof(float));
+    pthread_mutex_init(&lg.lock, NULL);
+
+    double start = now_seconds() * 1e3;
+    pthread_t* threads = (pthread_t*)malloc(concurrency * sizeof(pthread_t));
+    for (int i = 0; i < concurrency; ++i) {
+        pthread_create(&threads[i], NULL, loadgen_worker, &lg);
+    }
+    for (int i = 0; i < concurrency; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = (now_seconds() * 1e3 - start) / 1e3;
+
+    // Only requests that got a response carry a latency
+    int n_done = 0;
+    for (int i = 0; i < n_requests; ++i) {
+        if (lg.latencies[i] > 0.0f) {
+            lg.latencies[n_done] = lg.latencies[i];
+            lg.queue_ms[n_done] = lg.queue_ms[i];
+            lg.first_token[n_done] = lg.first_token[i];
+            n_done++;
+        }
+    }
+    qsort(lg.latencies, n_done, sizeof(float), compare_floats);
+    qsort(lg.queue_ms, n_done, sizeof(float), compare_floats);
+    qsort(lg.first_token, n_done, sizeof(float), compare_floats);
+
+    printf("Load: %d requests, concurrency %d, %d new tokens each\n", n_requests, concurrency, max_new_tokens);
+    printf("Completed: %d (%d errors) in %.2f s\n", n_done, lg.n_errors, seconds);
+    if (n_done > 0) {
+        printf("Throughput: %.2f requests/s, %.1f tokens/s\n", n_done / seconds, lg.n_tokens / seconds);
+        printf("Latency p50: %.2f ms, p99: %.2f ms\n",
+               lg.latencies[(n_done - 1) / 2], lg.latencies[(int)((n_done - 1) * 0.99)]);
+        printf("First token p50: %.2f ms, p99: %.2f ms\n",
+               lg.first_token[(n_done - 1) / 2], lg.first_token[(int)((n_done - 1) * 0.99)]);
+        printf("Queueing p50: %.2f ms, p99: %.2f ms\n",
+               lg.queue_ms[(n_done - 1) / 2], lg.queue_ms[(int)((n_done - 1) * 0.99)]);
+    }
+
+    free(threads);
+    free(lg.latencies);
+    free(lg.queue_ms);
+    free(lg.first_token);
+    pthread_mutex_destroy(&lg.lock);
+    return n_done == n_requests ? 0 : -1;
+}
@@ -0,0 +1,8 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+// Function prototypes
+int connect_to_server(const char* socket_path);
+int run_loadgen(const char* socket_path, const char* prompt, int n_requests, int concurrency, int max_new_tokens);
+
+#endif // LOADGEN_H
@@ -5,18 +5,72 @@
 #include "data.h"
 #include "tensor.h"
 #include "model.h"
+#include "eval.h"
+#include "speculative.h"
+#include "prefix_cache.h"
+#include "rng.h"
+#include "kernels.h"
+#include "server.h"
+#include "loadgen.h"
+#include "gemm_tune.h"
 
 // Parameters (matching Python script for conceptual consistency)
 #define BATCH_SIZE 64
 #define BLOCK_SIZE 128
 #define MAX_ITERS 100 // Reduced for quick demonstration
 #define EVAL_INTERVAL 10
+#define EVAL_STRIDE (BLOCK_SIZE / 2) // Sliding-window stride for validation loss
 #define N_EMBD 384
 #define N_HEAD 6
+#define N_KV_HEAD N_HEAD // Multi-head attention; a smaller divisor of N_HEAD opts into grouped-query (1: multi-query)
 #define N_LAYER 6
-
-int main() {
-    srand(time(NULL)); // Initialize random seed for generation
+#define DRAFT_N_EMBD 128 // Draft model for speculative decoding
+#define DRAFT_N_HEAD 4
+#define DRAFT_N_KV_HEAD 1 // The draft only proposes tokens, so it uses multi-query attention
+#define DRAFT_N_LAYER 1
+#define MAX_DRAFT_LEN 8
+#define PREFIX_CACHE_MB 64 // Memory budget of the cross-request prompt prefix cache
+#define PIPELINE_MICRO_BATCH 4 // Windows per micro-batch of pipelined eval
+#define SPARSE_EVAL_TOKENS 8192 // Fixed validation slice for the 2:4 accuracy delta
+#define DEFAULT_SOCKET_PATH "/tmp/gptc.sock"
+#define DEFAULT_SESSIONS 4 // Connections the daemon serves concurrently
+
+// Function to list the Linear-layer GEMM shapes of a model at a few row counts
+// (decode, one window, one training batch), i.e. the shapes "tune" benchmarks
+static int model_gemm_shapes(int n_embd, int n_head, int vocab_size, GemmShape* shapes) {
+    const int rows[] = {1, BLOCK_SIZE, BATCH_SIZE * BLOCK_SIZE};
+    const int kn[][2] = {
+        {n_embd, n_embd / n_head}, // Per-head query, per-group key/value
+        {n_embd, n_embd},          // Attention output projection
+        {n_embd, 4 * n_embd},      // Feed-forward expansion
+        {4 * n_embd, n_embd},      // Feed-forward contraction
+        {n_embd, vocab_size},      // lm_head
+    };
+    int n_shapes = 0;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 5; ++j) {
+            shapes[n_shapes++] = (GemmShape){rows[i], kn[j][0], kn[j][1]};
+        }
+    }
+    return n_shapes;
+}
+
+int main(int argc, char** argv) {
+    // Seed every RNG stream (GPTC_SEED makes runs reproducible)
+    const char* seed_env = getenv("GPTC_SEED");
+    rng_set_seed(seed_env ? strtoull(seed_env, NULL, 10) : (uint64_t)time(NULL));
+
+    // Pick the kernel tier for this CPU once, up front (logs the choice)
+    get_kernels();
+    gemm_tuning_load();
+
+    // Load generator mode: only talks to a running server, no model needed
+    if (argc > 1 && strcmp(argv[1], "loadgen") == 0) {
+        const char* socket_path = argc > 2 ? argv[2] : DEFAULT_SOCKET_PATH;
+        int n_requests = argc > 3 ? atoi(argv[3]) : 64;
+        int concurrency = argc > 4 ? atoi(argv[4]) : DEFAULT_SESSIONS;
+        return run_loadgen(socket_path, "The ", n_requests, concurrency, 100) == 0 ? 0 : 1;
+    }
 
     // Read the content of the text file
     char* raw_text = read_file_content("pride_and_prejudice.txt");
@@ -33,63 +87,151 @@ int main() {
     int* encoded_data = encode(raw_text, vocab);
     int data_len = strlen(raw_text);
 
-    // Split data into train and validation sets (conceptually)
+    // Split data into train and validation sets
     int n = (int)(0.9 * data_len);
-    int* train_data = encoded_data; // For simplicity, use full data as train
-    int train_data_len = data_len;
-    // int* val_data = encoded_data + n; // Not used in this placeholder
-    // int val_data_len = data_len - n;
+    int* train_data = encoded_data;
+    int train_data_len = n;
+    int* val_data = encoded_data + n;
+    int val_data_len = data_len - n;
+
+    // Tuning mode: benchmark GEMM blockings for this model's shapes and update the cache
+    if (argc > 1 && strcmp(argv[1], "tune") == 0) {
+        GemmShape shapes[30];
+        int n_shapes = model_gemm_shapes(N_EMBD, N_HEAD, vocab_size, shapes);
+        n_shapes += model_gemm_shapes(DRAFT_N_EMBD, DRAFT_N_HEAD, vocab_size, shapes + n_shapes);
+        int rc = gemm_autotune(shapes, n_shapes, argc > 2 ? argv[2] : gemm_tuning_path());
+
+        free(raw_text);
+        free(encoded_data);
+        free_vocabulary(vocab);
+        return rc == 0 ? 0 : 1;
+    }
+
+    prefix_cache_set_budget((size_t)PREFIX_CACHE_MB << 20);
 
     // Create the model
-    BigramLanguageModel* model = create_bigram_language_model(vocab_size, N_EMBD, BLOCK_SIZE, N_LAYER, N_HEAD);
+    BigramLanguageModel* model = create_bigram_language_model(vocab_size, N_EMBD, BLOCK_SIZE, N_LAYER, N_HEAD, N_KV_HEAD);
+
+    // Evaluation mode: score the full validation split and exit
+    // "eval N [M]" pipelines the blocks over N stages with micro-batches of M windows
+    if (argc > 1 && strcmp(argv[1], "eval") == 0) {
+        int n_stages = argc > 2 ? atoi(argv[2]) : 1;
+        if (n_stages > 1) {
+            int micro_batch = argc > 3 ? atoi(argv[3]) : PIPELINE_MICRO_BATCH;
+            PipelineStats pipe_stats;
+            EvalResult val = evaluate_split_pipelined(model, val_data, val_data_len, BLOCK_SIZE, EVAL_STRIDE,
+                                                      n_stages, micro_batch, &pipe_stats);
+            print_eval_result("Validation (pipelined)", &val);
+            print_pipeline_stats(&pipe_stats);
+            free_pipeline_stats(&pipe_stats);
+        } else {
+            EvalResult val = evaluate_split(model, val_data, val_data_len, BLOCK_SIZE, EVAL_STRIDE);
+            print_eval_result("Validation", &val);
+        }
+
+        free(raw_text);
+        free(encoded_data);
+        free_vocabulary(vocab);
+        free_bigram_language_model(model);
+        return 0;
+    }
+
+    // Sparsity mode: prune every feed-forward Linear to 2:4 and report the accuracy
+    // delta against the dense model on a fixed slice of the validation split
+    if (argc > 1 && strcmp(argv[1], "sparse") == 0) {
+        int eval_len = val_data_len < SPARSE_EVAL_TOKENS ? val_data_len : SPARSE_EVAL_TOKENS;
+        EvalResult dense = evaluate_split(model, val_data, eval_len, BLOCK_SIZE, EVAL_STRIDE);
+        size_t dense_bytes = model_ffn_weight_bytes(model);
+        int rc = model_prune_ffn_2_4(model);
+        if (rc == 0) {
+            EvalResult sparse = evaluate_split(model, val_data, eval_len, BLOCK_SIZE, EVAL_STRIDE);
+            print_eval_result("Dense", &dense);
+            print_eval_result("2:4 FFN", &sparse);
+            printf("Loss delta %+.4f, perplexity delta %+.3f, FFN weights %.2f MiB -> %.2f MiB\n",
+                   sparse.loss - dense.loss, sparse.perplexity - dense.perplexity,
+                   dense_bytes / 1048576.0, model_ffn_weight_bytes(model) / 1048576.0);
+        }
+
+        free(raw_text);
+        free(encoded_data);
+        free_vocabulary(vocab);
+        free_bigram_language_model(model);
+        return rc == 0 ? 0 : 1;
+    }
+
+    // Daemon mode: keep the model resident and serve requests until SIGINT/SIGTERM
+    if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+        const char* socket_path = argc > 2 ? argv[2] : DEFAULT_SOCKET_PATH;
+        int n_sessions = argc > 3 ? atoi(argv[3]) : DEFAULT_SESSIONS;
+        int rc = run_server(model, vocab, socket_path, n_sessions);
+
+        print_prefix_cache_stats();
+        free(raw_text);
+        free(encoded_data);
+        free_vocabulary(vocab);
+        free_bigram_language_model(model);
+        return rc == 0 ? 0 : 1;
+    }
 
     printf("\nStarting placeholder training loop...\n");
+    // Batch and activation tensors are allocated once and refilled every step
+    int batch_shape[] = {BATCH_SIZE, BLOCK_SIZE};
+    Tensor* xb = create_tensor(batch_shape, 2);
+    Tensor* yb = create_tensor(batch_shape, 2);
+    int hidden_shape[] = {BATCH_SIZE, BLOCK_SIZE, N_EMBD};
+    Tensor* hidden = create_tensor(hidden_shape, 3);
     for (int iter = 0; iter < MAX_ITERS; ++iter) {
         if (iter % EVAL_INTERVAL == 0) {
-            // In a real scenario, you'd evaluate on validation set here
-            printf("Step %d: (Placeholder) Loss calculation...\n", iter);
+            EvalResult val = evaluate_split(model, val_data, val_data_len, BLOCK_SIZE, EVAL_STRIDE);
+            printf("Step %d: ", iter);
+            print_eval_result("val", &val);
         }
 
         // Get a batch of data
-        Tensor* xb = NULL;
-        Tensor* yb = NULL;
         get_batch(train_data, train_data_len, BATCH_SIZE, BLOCK_SIZE, &xb, &yb);
 
-        // Perform forward pass
-        Tensor* logits = model_forward(model, xb);
-
-        // Reshape yb for loss calculation (B*T, 1) -> (B*T)
-        int target_flat_shape[] = {BATCH_SIZE * BLOCK_SIZE};
-        Tensor* yb_flat = create_tensor(target_flat_shape, 1);
-        for(int i=0; i < BATCH_SIZE * BLOCK_SIZE; ++i) {
-            yb_flat->data[i] = yb->data[i];
+        // Perform forward pass up to the final layer norm through the recorded,
+        // fused graph; lm_head and the loss are fused so the (B*T, vocab_size)
+        // logits are never materialized
+        if (model_forward_fused_into(model, xb, 0, hidden) != 0) {
+            break;
         }
 
-        // Reshape logits for loss calculation (B, T, vocab_size) -> (B*T, vocab_size)
-        int logits_flat_shape[] = {BATCH_SIZE * BLOCK_SIZE, vocab_size};
-        Tensor* logits_flat = create_tensor(logits_flat_shape, 2);
-        memcpy(logits_flat->data, logits->data, logits->size * sizeof(float));
-
         // Calculate loss
-        float loss = cross_entropy_loss(logits_flat, yb_flat);
+        float loss = lm_head_cross_entropy(model->lm_head, hidden, yb);
         printf("  Loss: %.4f\n", loss);
 
         // In a real scenario, backpropagation and optimizer.step() would go here
-
-        // Clean up batch tensors
-        free_tensor(xb);
-        free_tensor(yb);
-        free_tensor(logits);
-        free_tensor(yb_flat);
-        free_tensor(logits_flat);
     }
+    free_tensor(xb);
+    free_tensor(yb);
+    free_tensor(hidden);
     printf("Placeholder training loop finished.\n");
 
     // Generate text after (conceptual) training
     const char* start_text = "The ";
     int max_new_tokens = 100;
-    char* generated_text = generate(model, vocab, start_text, max_new_tokens);
-    printf("\nGenerated Text:\n%s\n", generated_text);
+    // Stream tokens to stdout as they are sampled
+    printf("\nGenerated Text:\n%s", start_text);
+    fflush(stdout);
+    int stdout_fd = fileno(stdout);
+    GenerationStats gen_stats;
+    char* generated_text = generate_stream(model, vocab, start_text, max_new_tokens, NULL,
+                                           write_token_to_fd, &stdout_fd, &gen_stats);
+    printf("\n");
+    print_generation_stats(&gen_stats);
+
+    // Same prompt with speculative decoding against a small draft model
+    BigramLanguageModel* draft = create_bigram_language_model(vocab_size, DRAFT_N_EMBD, BLOCK_SIZE, DRAFT_N_LAYER, DRAFT_N_HEAD, DRAFT_N_KV_HEAD);
+    SpeculativeStats spec_stats;
+    char* speculative_text = generate_speculative(model, draft, vocab, start_text, max_new_tokens, MAX_DRAFT_LEN, &spec_stats);
+    if (speculative_text) {
+        printf("\nGenerated Text (speculative):\n%s\n", speculative_text);
+        print_speculative_stats(&spec_stats);
+        free(speculative_text);
+    }
+    free_bigram_language_model(draft);
+    print_prefix_cache_stats();
 
     // Clean up all allocated memory
     free(raw_text);
@@ -1,7 +1,22 @@
 #include "model.h"
+#include "prefix_cache.h"
+#include "vmath.h"
+#include "rng.h"
+#include "threads.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 // Function to create the Bigram Language Model
-BigramLanguageModel* create_bigram_language_model(int vocab_size, int n_embd, int block_size, int n_layer, int n_head) {
+// n_kv_head == n_head gives standard multi-head attention, 1 multi-query attention
+// and any other divisor of n_head grouped-query attention.
+BigramLanguageModel* create_bigram_language_model(int vocab_size, int n_embd, int block_size, int n_layer, int n_head, int n_kv_head) {
+    if (n_kv_head <= 0 || n_kv_head > n_head || n_head % n_kv_head != 0) {
+        fprintf(stderr, "Error: %d attention heads cannot be split into %d key/value groups.\n", n_head, n_kv_head);
+        return NULL;
+    }
     BigramLanguageModel* model = (BigramLanguageModel*)malloc(sizeof(BigramLanguageModel));
 
     int token_emb_shape[] = {vocab_size, n_embd};
@@ -10,15 +25,24 @@ BigramLanguageModel* create_bigram_language_model(int vocab_size, int n_embd, in
     int pos_emb_shape[] = {block_size, n_embd};
     model->position_embedding_table = create_tensor(pos_emb_shape, 2);
 
+    // Embeddings start as N(0, 1)
+    RngStream tok_rng = rng_stream(RNG_INIT, rng_next_stream_id(RNG_INIT));
+    rng_fill_normal_parallel(&tok_rng, model->token_embedding_table->data, model->token_embedding_table->size, 0.0f, 1.0f);
+    RngStream pos_rng = rng_stream(RNG_INIT, rng_next_stream_id(RNG_INIT));
+    rng_fill_normal_parallel(&pos_rng, model->position_embedding_table->data, model->position_embedding_table->size, 0.0f, 1.0f);
+
     model->n_layers = n_layer;
     model->blocks = (Block**)malloc(n_layer * sizeof(Block*));
     for (int i = 0; i < n_layer; ++i) {
-        model->blocks[i] = create_block(n_embd, n_head);
+        model->blocks[i] = create_block(n_embd, n_head, n_kv_head);
     }
 
     model->lm_head = create_linear_layer(n_embd, vocab_size);
     model->ln_final = create_layer_norm(n_embd);
 
+    model->graphs = NULL;
+    pthread_mutex_init(&model->graph_lock, NULL);
+
     return model;
 }
 
@@ -32,46 +56,73 @@ void free_bigram_language_model(BigramLanguageModel* model) {
     free(model->blocks);
     free_linear_layer(model->lm_head);
     free_layer_norm(model->ln_final);
+    while (model->graphs) {
+        ModelGraph* next = model->graphs->next;
+        free_graph(model->graphs->graph);
+        free(model->graphs);
+        model->graphs = next;
+    }
+    pthread_mutex_destroy(&model->graph_lock);
+    prefix_cache_drop_model(model);
     free(model);
 }
 
-// Forward pass for the Bigram Language Model
-Tensor* model_forward(BigramLanguageModel* model, const Tensor* idx) {
-    // For simplicity, this forward pass will handle a single input sequence
+// Function to get the weight bytes the feed-forward layers of all blocks read per forward
+size_t model_ffn_weight_bytes(const BigramLanguageModel* model) {
+    size_t bytes = 0;
+    for (int i = 0; i < model->n_layers; ++i) {
+        bytes += linear_weight_bytes(model->blocks[i]->ffwd->layer1);
+        bytes += linear_weight_bytes(model->blocks[i]->ffwd->layer2);
+    }
+    return bytes;
+}
+
+// Function to prune the feed-forward layers of every block to 2:4 sparsity
+// Every layer is checked first, so a shape error leaves the model dense. Cached
+// prompt prefixes were computed with the dense weights, so they are dropped
+// whenever anything may have been pruned.
+int model_prune_ffn_2_4(BigramLanguageModel* model) {
+    for (int i = 0; i < model->n_layers; ++i) {
+        FeedForward* ffwd = model->blocks[i]->ffwd;
+        if (!linear_can_prune_2_4(ffwd->layer1) || !linear_can_prune_2_4(ffwd->layer2)) {
+            fprintf(stderr, "Error: feed-forward layers of block %d cannot be compressed to 2:4.\n", i);
+            return -1;
+        }
+    }
+    int rc = 0;
+    for (int i = 0; i < model->n_layers && rc == 0; ++i) {
+        rc = feed_forward_prune_2_4(model->blocks[i]->ffwd);
+    }
+    prefix_cache_drop_model(model);
+    return rc;
+}
+
+// Forward pass up to the final layer norm, returning (B, T, n_embd) hidden states
+// idx is (B, T) token ids; every batch row is an independent sequence.
+Tensor* model_forward_hidden(BigramLanguageModel* model, const Tensor* idx) {
+    if (idx->n_dims != 2 || idx->shape[1] > model->position_embedding_table->shape[0]) {
+        fprintf(stderr, "model_forward expects (B, T) token ids with T <= block_size.\n");
+        return NULL;
+    }
     int B = idx->shape[0];
     int T = idx->shape[1];
+    int n_embd = model->token_embedding_table->shape[1];
 
-    int tok_emb_shape[] = {B, T, model->token_embedding_table->shape[1]};
-    Tensor* tok_emb = create_tensor(tok_emb_shape, 3);
-
-    // Manual embedding lookup
+    // Token plus position embeddings
+    int x_shape[] = {B, T, n_embd};
+    Tensor* x = create_tensor(x_shape, 3);
     for (int b = 0; b < B; ++b) {
         for (int t = 0; t < T; ++t) {
-            int indices[] = {b, t};
-            int token_index = (int)get_tensor_value(idx, indices);
-            for (int c = 0; c < tok_emb_shape[2]; ++c) {
-                int src_indices[] = {token_index, c};
-                int dest_indices[] = {b, t, c};
-                set_tensor_value(tok_emb, dest_indices, get_tensor_value(model->token_embedding_table, src_indices));
+            int token_index = (int)idx->data[b * T + t];
+            const float* tok = model->token_embedding_table->data + (size_t)token_index * n_embd;
+            const float* pos = model->position_embedding_table->data + (size_t)t * n_embd;
+            float* dst = x->data + ((size_t)b * T + t) * n_embd;
+            for (int c = 0; c < n_embd; ++c) {
+                dst[c] = tok[c] + pos[c];
             }
         }
     }
 
-    // Positional embedding
-    int pos_emb_shape[] = {T, model->position_embedding_table->shape[1]};
-    Tensor* pos_emb = create_tensor(pos_emb_shape, 2);
-    for (int t = 0; t < T; ++t) {
-        for (int c = 0; c < pos_emb_shape[1]; ++c) {
-            int src_indices[] = {t, c};
-            int dest_indices[] = {t, c};
-            set_tensor_value(pos_emb, dest_indices, get_tensor_value(model->position_embedding_table, src_indices));
-        }
-    }
-
-    Tensor* x = add(tok_emb, pos_emb);
-    free_tensor(tok_emb);
-    free_tensor(pos_emb);
-
     for (int i = 0; i < model->n_layers; ++i) {
         Tensor* next_x = block_forward(model->blocks[i], x);
         free_tensor(x);
@@ -81,11 +132,146 @@ Tensor* model_forward(BigramLanguageModel* model, const Tensor* idx) {
     // Final layer normalization
     Tensor* ln_final_out = layer_norm_forward(model->ln_final, x);
     free_tensor(x);
-    x = ln_final_out;
+    return ln_final_out;
+}
 
+// Forward pass for the Bigram Language Model
+Tensor* model_forward(BigramLanguageModel* model, const Tensor* idx) {
+    Tensor* x = model_forward_hidden(model, idx);
+    if (!x) {
+        return NULL;
+    }
     Tensor* logits = linear_forward(model->lm_head, x);
     free_tensor(x);
+    return logits;
+}
+
+// Function to record model_forward (or model_forward_hidden) for (batch, block) token ids
+// The graph is fused and its buffers planned; it stays valid while the model
+// lives, and weight updates are picked up on the next run.
+Graph* model_record(BigramLanguageModel* model, int batch, int block, int with_logits) {
+    Graph* g = create_graph();
+    int x = graph_embed(g, model->token_embedding_table, model->position_embedding_table, batch, block);
+    for (int i = 0; i < model->n_layers; ++i) {
+        x = block_record(model->blocks[i], g, x);
+    }
+    x = graph_layer_norm(g, model->ln_final, x);
+    if (with_logits) {
+        x = graph_linear(g, model->lm_head, x);
+    }
+    if (graph_compile(g, x) != 0) {
+        free_graph(g);
+        return NULL;
+    }
+    return g;
+}
+
+// Function to run the forward pass through the fused graph for idx's shape, into out
+// out receives the hidden states, or the logits if with_logits is set. Graphs are
+// recorded on first use of a shape and the MODEL_GRAPH_CACHE most recently used
+// are kept, so this suits a few fixed shapes (training and eval batches), not
+// arbitrary ones. Concurrent calls on one model run one at a time.
+int model_forward_fused_into(BigramLanguageModel* model, const Tensor* idx, int with_logits, Tensor* out) {
+    if (idx->n_dims != 2) {
+        fprintf(stderr, "model_forward_fused expects (B, T) token ids.\n");
+        return -1;
+    }
+    int batch = idx->shape[0];
+    int block = idx->shape[1];
+
+    pthread_mutex_lock(&model->graph_lock);
+    ModelGraph** link = &model->graphs;
+    while (*link && ((*link)->batch != batch || (*link)->block != block || (*link)->with_logits != with_logits)) {
+        link = &(*link)->next;
+    }
+    ModelGraph* entry = *link;
+    if (entry) {
+        // Move to the front
+        *link = entry->next;
+        entry->next = model->graphs;
+        model->graphs = entry;
+    } else {
+        Graph* g = model_record(model, batch, block, with_logits);
+        if (!g) {
+            pthread_mutex_unlock(&model->graph_lock);
+            return -1;
+        }
+        fprintf(stderr, "Recorded forward graph for (%d, %d)%s. ", batch, block, with_logits ? " with logits" : "");
+        print_graph_summary(g);
+        entry = (ModelGraph*)malloc(sizeof(ModelGraph));
+        entry->graph = g;
+        entry->batch = batch;
+        entry->block = block;
+        entry->with_logits = with_logits;
+        entry->next = model->graphs;
+        model->graphs = entry;
+
+        // Drop the least recently used graphs beyond the cap
+        ModelGraph* last = entry;
+        for (int i = 1; i < MODEL_GRAPH_CACHE && last->next; ++i) {
+            last = last->next;
+        }
+        while (last->next) {
+            ModelGraph* evicted = last->next;
+            last->next = evicted->next;
+            free_graph(evicted->graph);
+            free(evicted);
+        }
+    }
+    int rc = graph_run(entry->graph, idx, out);
+    pthread_mutex_unlock(&model->graph_lock);
+    return rc;
+}
+
+// Function to compute model_forward_hidden through the fused graph
+Tensor* model_forward_hidden_fused(BigramLanguageModel* model, const Tensor* idx) {
+    if (idx->n_dims != 2) {
+        fprintf(stderr, "model_forward_fused expects (B, T) token ids.\n");
+        return NULL;
+    }
+    int hidden_shape[] = {idx->shape[0], idx->shape[1], model->token_embedding_table->shape[1]};
+    Tensor* hidden = create_tensor(hidden_shape, 3);
+    if (model_forward_fused_into(model, idx, 0, hidden) != 0) {
+        free_tensor(hidden);
+        return NULL;
+    }
+    return hidden;
+}
 
+// Function to compute model_forward through the fused graph
+Tensor* model_forward_fused(BigramLanguageModel* model, const Tensor* idx) {
+    if (idx->n_dims != 2) {
+        fprintf(stderr, "model_forward_fused expects (B, T) token ids.\n");
+        return NULL;
+    }
+    int logits_shape[] = {idx->shape[0], idx->shape[1], model->lm_head->weights->shape[1]};
+    Tensor* logits = create_tensor(logits_shape, 3);
+    if (model_forward_fused_into(model, idx, 1, logits) != 0) {
+        free_tensor(logits);
+        return NULL;
+    }
+    return logits;
+}
+
+// Function to apply lm_head to the last n_rows rows of hidden states only, into out
+int model_logits_last_into(BigramLanguageModel* model, const Tensor* hidden, int n_rows, Tensor* out) {
+    int n_embd = hidden->shape[hidden->n_dims - 1];
+    int total_rows = hidden->size / n_embd;
+
+    // A borrowed (n_rows, n_embd) view of the tail of hidden
+    int rows_shape[] = {n_rows, n_embd};
+    Tensor rows = tensor_view(hidden->data + (size_t)(total_rows - n_rows) * n_embd, rows_shape, 2);
+    return linear_forward_into(model->lm_head, &rows, out);
+}
+
+// Function to apply lm_head to the last n_rows rows of hidden states only
+Tensor* model_logits_last(BigramLanguageModel* model, const Tensor* hidden, int n_rows) {
+    int out_shape[] = {n_rows, model->lm_head->weights->shape[1]};
+    Tensor* logits = create_tensor(out_shape, 2);
+    if (model_logits_last_into(model, hidden, n_rows, logits) != 0) {
+        free_tensor(logits);
+        return NULL;
+    }
     return logits;
 }
 
@@ -107,84 +293,454 @@ float cross_entropy_loss(const Tensor* logits, const Tensor* targets) {
 
     for (int i = 0; i < num_elements; ++i) {
         int target_idx = (int)targets->data[i];
-        float log_softmax_val = -INFINITY;
+        const float* row = logits->data + (size_t)i * vocab_size;
+
+        // log_softmax(row)[target] = row[target] - logsumexp(row)
+        float log_softmax_val = row[target_idx] - row_logsumexp(row, vocab_size);
+        total_loss += -log_softmax_val;
+    }
+
+    return total_loss / num_elements;
+}
+
+// Run one (rows x chunk) tile of lm_head logits, bias included, into tile
+static void lm_head_logits_tile(Linear* lm_head, const PackedMatrix* w, const float* x, int rows,
+                                int j0, int n_cols, float* tile) {
+    PackedMatrix view;
+    view.data = w->data + (size_t)(j0 / GEMM_NR) * w->k * GEMM_NR;
+    view.k = w->k;
+    view.n = n_cols;
+    gemm_packed(x, rows, &view, tile);
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < n_cols; ++j) {
+            tile[i * n_cols + j] += lm_head->bias->data[j0 + j];
+        }
+    }
+}
 
-        // Compute log_softmax for the current row of logits
-        float max_logit = -INFINITY;
-        for (int j = 0; j < vocab_size; ++j) {
-            if (logits->data[i * vocab_size + j] > max_logit) {
-                max_logit = logits->data[i * vocab_size + j];
+// Function to compute cross_entropy_loss(lm_head(x), targets) without materializing logits
+// x is (..., n_embd) and targets holds one class index per row of x. Logits are
+// produced in CE_ROW_BLOCK x CE_VOCAB_CHUNK tiles while a running max and sum-exp
+// (online log-sum-exp) and the target logit are tracked per row. Returns -1 if the
+// shapes do not match or a target is not a vocabulary index.
+float lm_head_cross_entropy(Linear* lm_head, const Tensor* x, const Tensor* targets) {
+    int n_embd = lm_head->weights->shape[0];
+    int vocab_size = lm_head->weights->shape[1];
+    if (x->shape[x->n_dims - 1] != n_embd) {
+        fprintf(stderr, "Invalid tensor dimensions for lm_head_cross_entropy.\n");
+        return -1.0f;
+    }
+    int rows = x->size / n_embd;
+    if (targets->size != rows) {
+        fprintf(stderr, "Batch sizes do not match for lm_head_cross_entropy.\n");
+        return -1.0f;
+    }
+    for (int i = 0; i < rows; ++i) {
+        float target = targets->data[i];
+        if (!(target >= 0.0f && target < vocab_size)) {
+            fprintf(stderr, "Target %g at row %d is outside the vocabulary of %d for lm_head_cross_entropy.\n",
+                    target, i, vocab_size);
+            return -1.0f;
+        }
+    }
+
+    PackedMatrix* w = linear_packed_weights(lm_head);
+    float tile[CE_ROW_BLOCK * CE_VOCAB_CHUNK]; // 64 KiB, on the stack so a training step does not allocate
+    float max_logit[CE_ROW_BLOCK];
+    float sum_exp[CE_ROW_BLOCK];
+    float target_logit[CE_ROW_BLOCK];
+    double total_loss = 0.0;
+
+    for (int r0 = 0; r0 < rows; r0 += CE_ROW_BLOCK) {
+        int mr = (rows - r0 < CE_ROW_BLOCK) ? (rows - r0) : CE_ROW_BLOCK;
+        for (int i = 0; i < mr; ++i) {
+            max_logit[i] = -INFINITY;
+            sum_exp[i] = 0.0f;
+            target_logit[i] = 0.0f;
+        }
+
+        for (int j0 = 0; j0 < vocab_size; j0 += CE_VOCAB_CHUNK) {
+            int nc = (vocab_size - j0 < CE_VOCAB_CHUNK) ? (vocab_size - j0) : CE_VOCAB_CHUNK;
+            lm_head_logits_tile(lm_head, w, x->data + (size_t)r0 * n_embd, mr, j0, nc, tile);
+
+            for (int i = 0; i < mr; ++i) {
+                const float* row = tile + i * nc;
+                float chunk_max = row_max(row, nc);
+                if (chunk_max > max_logit[i]) {
+                    sum_exp[i] *= expf(max_logit[i] - chunk_max);
+                    max_logit[i] = chunk_max;
+                }
+                sum_exp[i] += row_sum_exp(row, nc, max_logit[i]);
+                int target = (int)targets->data[r0 + i];
+                if (target >= j0 && target < j0 + nc) {
+                    target_logit[i] = row[target - j0];
+                }
             }
         }
 
-        float sum_exp = 0.0f;
-        for (int j = 0; j < vocab_size; ++j) {
-            sum_exp += expf(logits->data[i * vocab_size + j] - max_logit);
+        for (int i = 0; i < mr; ++i) {
+            total_loss += max_logit[i] + logf(sum_exp[i]) - target_logit[i];
         }
+    }
 
-        log_softmax_val = (logits->data[i * vocab_size + target_idx] - max_logit) - logf(sum_exp);
-        total_loss += -log_softmax_val;
+    return (float)(total_loss / rows);
+}
+
+// Function to create a KV cache sized for this model
+// Only the key/value heads are cached: n_head / n_kv_head times less than n_embd per row.
+KVCache* create_model_kv_cache(BigramLanguageModel* model) {
+    const MultiHeadAttention* sa = model->blocks[0]->sa;
+    int head_size = model->token_embedding_table->shape[1] / sa->n_heads;
+    return create_kv_cache(model->n_layers, sa->n_kv_heads * head_size, sa->n_heads / sa->n_kv_heads,
+                           model->position_embedding_table->shape[0]);
+}
+
+// Forward pass over new positions of a single sequence, reusing cached keys/values, into out
+// tokens hold positions [cache->len, cache->len + len); their keys/values are added
+// to the cache and out receives (len, n_embd) final hidden states for them. Every
+// intermediate lives in the cache's workspace, so repeated calls do not allocate.
+int model_forward_cached_hidden_into(BigramLanguageModel* model, const int* tokens, int len, KVCache* cache, Tensor* out) {
+    int past_len = cache->len;
+    if (len <= 0 || past_len + len > cache->capacity) {
+        fprintf(stderr, "Sequence does not fit in the KV cache.\n");
+        return -1;
     }
 
-    return total_loss / num_elements;
+    int n_embd = model->token_embedding_table->shape[1];
+    Tensor* x = workspace_matrix(cache->workspace, WS_RESIDUAL, len, n_embd);
+    for (int t = 0; t < len; ++t) {
+        const float* tok = model->token_embedding_table->data + (size_t)tokens[t] * n_embd;
+        const float* pos = model->position_embedding_table->data + (size_t)(past_len + t) * n_embd;
+        for (int c = 0; c < n_embd; ++c) {
+            x->data[t * n_embd + c] = tok[c] + pos[c];
+        }
+    }
+
+    for (int i = 0; i < model->n_layers; ++i) {
+        if (block_forward_cached_into(model->blocks[i], x, cache->k[i], cache->v[i], past_len, cache->workspace) != 0) {
+            return -1;
+        }
+    }
+    cache->len = past_len + len;
+
+    return layer_norm_forward_into(model->ln_final, x, out);
 }
 
-// Function to generate new text
+// Forward pass over new positions of a single sequence, reusing cached keys/values
+// Returns a freshly allocated (len, n_embd) tensor; see model_forward_cached_hidden_into.
+Tensor* model_forward_cached_hidden(BigramLanguageModel* model, const int* tokens, int len, KVCache* cache) {
+    int out_shape[] = {len, model->token_embedding_table->shape[1]};
+    Tensor* out = create_tensor(out_shape, 2);
+    if (model_forward_cached_hidden_into(model, tokens, len, cache, out) != 0) {
+        free_tensor(out);
+        return NULL;
+    }
+    return out;
+}
+
+// Same as model_forward_cached_hidden, returning (len, vocab_size) logits
+Tensor* model_forward_cached(BigramLanguageModel* model, const int* tokens, int len, KVCache* cache) {
+    Tensor* hidden = model_forward_cached_hidden(model, tokens, len, cache);
+    if (!hidden) {
+        return NULL;
+    }
+    Tensor* logits = linear_forward(model->lm_head, hidden);
+    free_tensor(hidden);
+    return logits;
+}
+
+// Function to run the model on a single token sequence, returning (len, n_embd) hidden states
+Tensor* model_forward_tokens_hidden(BigramLanguageModel* model, const int* tokens, int len) {
+    KVCache* cache = create_model_kv_cache(model);
+    Tensor* hidden = model_forward_cached_hidden(model, tokens, len, cache);
+    free_kv_cache(cache);
+    return hidden;
+}
+
+// Function to run the model on a single token sequence, returning (len, vocab_size) logits
+Tensor* model_forward_tokens(BigramLanguageModel* model, const int* tokens, int len) {
+    KVCache* cache = create_model_kv_cache(model);
+    Tensor* logits = model_forward_cached(model, tokens, len, cache);
+    free_kv_cache(cache);
+    return logits;
+}
+
+// Function to sample an index from a probability distribution
+int sample_from_distribution(const float* probs, int n, RngStream* rng) {
+    float r = rng_uniform(rng);
+    float cumulative_prob = 0.0f;
+    int last_nonzero = 0;
+    for (int j = 0; j < n; ++j) {
+        if (probs[j] > 0.0f) {
+            last_nonzero = j;
+        }
+        cumulative_prob += probs[j];
+        // Strict, so r == 0 cannot pick a leading zero-probability token
+        if (r < cumulative_prob) {
+            return j;
+        }
+    }
+    // Rounding left r above the total mass: fall back to the last possible token
+    return last_nonzero;
+}
+
+// Function to turn last-position logits into sampling probabilities in place
+// temperature <= 0 selects greedy decoding; top_k > 0 keeps only the k largest logits,
+// using scratch (n floats) to find the cut-off.
+static void logits_to_probs(float* logits, int n, const SamplingParams* params, float* scratch) {
+    if (params->temperature <= 0.0f) {
+        int best = 0;
+        for (int j = 1; j < n; ++j) {
+            if (logits[j] > logits[best]) {
+                best = j;
+            }
+        }
+        for (int j = 0; j < n; ++j) {
+            logits[j] = (j == best) ? 1.0f : 0.0f;
+        }
+        return;
+    }
+
+    if (params->top_k > 0 && params->top_k < n) {
+        // The k-th largest logit is the cut-off; ties at the cut-off are kept
+        float* sorted = scratch;
+        memcpy(sorted, logits, n * sizeof(float));
+        for (int i = 0; i < params->top_k; ++i) {
+            int max_idx = i;
+            for (int j = i + 1; j < n; ++j) {
+                if (sorted[j] > sorted[max_idx]) {
+                    max_idx = j;
+                }
+            }
+            float tmp = sorted[i];
+            sorted[i] = sorted[max_idx];
+            sorted[max_idx] = tmp;
+        }
+        float cutoff = sorted[params->top_k - 1];
+        for (int j = 0; j < n; ++j) {
+            if (logits[j] < cutoff) {
+                logits[j] = -INFINITY;
+            }
+        }
+    }
+
+    if (params->temperature != 1.0f) {
+        for (int j = 0; j < n; ++j) {
+            logits[j] /= params->temperature;
+        }
+    }
+    row_softmax(logits, n);
+}
+
+// Function to generate new text with the default sampling parameters
 char* generate(BigramLanguageModel* model, Vocabulary* vocab, const char* start_text, int max_new_tokens) {
+    return generate_with_params(model, vocab, start_text, max_new_tokens, NULL);
+}
+
+// Function to generate new text
+// params may be NULL for plain sampling (temperature 1, no top-k, fresh stream).
+char* generate_with_params(BigramLanguageModel* model, Vocabulary* vocab, const char* start_text,
+                           int max_new_tokens, const SamplingParams* params) {
+    return generate_stream(model, vocab, start_text, max_new_tokens, params, NULL, NULL, NULL);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Function to fill the latency fields of stats from the token hand-off times
+static void summarize_generation(GenerationStats* stats, double start, double prefill_end,
+                                 const double* token_times, int n_tokens) {
+    memset(stats, 0, sizeof(GenerationStats));
+    stats->n_tokens = n_tokens;
+    stats->prefill_seconds = prefill_end - start;
+    stats->total_seconds = now_seconds() - start;
+    if (n_tokens == 0) {
+        return;
+    }
+    stats->ttft_seconds = token_times[0] - start;
+    if (n_tokens < 2) {
+        return;
+    }
+    int n_gaps = n_tokens - 1;
+    double* gaps = (double*)malloc(n_gaps * sizeof(double));
+    double sum = 0.0;
+    for (int i = 0; i < n_gaps; ++i) {
+        gaps[i] = token_times[i + 1] - token_times[i];
+        sum += gaps[i];
+    }
+    qsort(gaps, n_gaps, sizeof(double), compare_doubles);
+    stats->itl_mean_seconds = sum / n_gaps;
+    stats->itl_p50_seconds = gaps[(n_gaps - 1) / 2];
+    stats->itl_p99_seconds = gaps[(int)((n_gaps - 1) * 0.99)];
+    stats->itl_max_seconds = gaps[n_gaps - 1];
+    free(gaps);
+}
+
+// Function to generate new text, handing each sampled token to on_token as soon as
+// it exists. on_token (may be NULL) returns nonzero to stop generation early; the
+// returned string then holds the prompt plus the tokens produced so far.
+// stats (may be NULL) receives prefill, time-to-first-token and inter-token latency.
+// Returns NULL (with stats zeroed) if the prompt is empty, max_new_tokens is negative
+// or memory runs out.
+char* generate_stream(BigramLanguageModel* model, Vocabulary* vocab, const char* start_text,
+                      int max_new_tokens, const SamplingParams* params,
+                      TokenCallback on_token, void* user_data, GenerationStats* stats) {
+    SamplingParams defaults = {1.0f, 0, 0, 0};
+    if (!params) {
+        params = &defaults;
+    }
+    double start_time = now_seconds();
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    if (max_new_tokens < 0) {
+        fprintf(stderr, "Error: cannot generate %d tokens.\n", max_new_tokens);
+        return NULL;
+    }
+    // Sampling continues from the last prompt position, so there must be one
+    if (!start_text || start_text[0] == '\0') {
+        fprintf(stderr, "Error: cannot generate from an empty prompt.\n");
+        return NULL;
+    }
+
     int current_len = strlen(start_text);
     int* encoded_start = encode(start_text, vocab);
 
+    // Every generation samples from its own stream; an explicit seed makes it reproducible
+    RngStream rng = rng_stream(RNG_SAMPLE, params->has_seed ? params->seed : rng_next_stream_id(RNG_SAMPLE));
+
     // Create a dynamic array to hold the generated sequence
-    int* generated_sequence = (int*)malloc((current_len + max_new_tokens) * sizeof(int));
+    int* generated_sequence = (int*)malloc(((size_t)current_len + max_new_tokens) * sizeof(int));
+    double* token_times = stats ? (double*)malloc((max_new_tokens > 0 ? max_new_tokens : 1) * sizeof(double)) : NULL;
+    if ((!encoded_start && current_len > 0) || !generated_sequence || (stats && !token_times)) {
+        fprintf(stderr, "Error: failed to allocate a generation of %d tokens.\n", max_new_tokens);
+        free(encoded_start);
+        free(generated_sequence);
+        free(token_times);
+        return NULL;
+    }
     memcpy(generated_sequence, encoded_start, current_len * sizeof(int));
     free(encoded_start);
-
-    for (int i = 0; i < max_new_tokens; ++i) {
-        // Crop the sequence to the last block_size tokens
-        int start_idx = (current_len > model->position_embedding_table->shape[0]) ? 
-                         (current_len - model->position_embedding_table->shape[0]) : 0;
-        int context_len = current_len - start_idx;
-
-        int* context_data = (int*)malloc(context_len * sizeof(int));
-        memcpy(context_data, generated_sequence + start_idx, context_len * sizeof(int));
-
-        int context_shape[] = {1, context_len};
-        Tensor* context_tensor = create_tensor(context_shape, 2);
-        for(int j=0; j<context_len; ++j) {
-            context_tensor->data[j] = (float)context_data[j];
+    int n_generated = 0;
+    int cancelled = 0;
+
+    // Buffers of the decode loop are allocated once here and reused for every token
+    int n_embd = model->token_embedding_table->shape[1];
+    int vocab_size = model->lm_head->weights->shape[1];
+    int hidden_shape[] = {1, n_embd};
+    int logits_shape[] = {1, vocab_size};
+    Tensor* hidden = create_tensor(hidden_shape, 2);
+    Tensor* last_logits = create_tensor(logits_shape, 2);
+    float* sort_scratch = (float*)malloc(vocab_size * sizeof(float));
+    KVCache* cache = create_model_kv_cache(model);
+    if (!hidden || !last_logits || !sort_scratch || !cache) {
+        fprintf(stderr, "Error: failed to allocate the decode buffers.\n");
+        if (hidden) {
+            free_tensor(hidden);
+        }
+        if (last_logits) {
+            free_tensor(last_logits);
         }
-        free(context_data);
+        if (cache) {
+            free_kv_cache(cache);
+        }
+        free(sort_scratch);
+        free(generated_sequence);
+        free(token_times);
+        return NULL;
+    }
 
-        Tensor* logits = model_forward(model, context_tensor);
-        free_tensor(context_tensor);
+    // Prefill: reuse the longest cached prefix of the prompt and only compute the
+    // positions after it. The last prompt position is always recomputed for its logits.
+    int block_size = model->position_embedding_table->shape[0];
+    int ok;
+    if (current_len <= block_size) {
+        int reused = prefix_cache_lookup(model, generated_sequence, current_len - 1, cache);
+        ok = model_forward_cached_hidden_into(model, generated_sequence + reused, current_len - reused, cache, hidden) == 0;
+        prefix_cache_insert(model, generated_sequence, current_len, cache);
+    } else {
+        ok = model_forward_cached_hidden_into(model, generated_sequence + current_len - block_size, block_size,
+                                              cache, hidden) == 0;
+    }
+    double prefill_end = now_seconds();
 
-        // Get the logits for the last token
-        int last_token_logits_offset = (logits->shape[0] - 1) * logits->shape[1];
-        Tensor* last_logits = create_tensor((int[]){1, logits->shape[1]}, 2);
-        for(int j=0; j<logits->shape[1]; ++j) {
-            last_logits->data[j] = logits->data[last_token_logits_offset + j];
+    for (int i = 0; i < max_new_tokens && ok; ++i) {
+        // Only the last position needs logits
+        if (model_logits_last_into(model, hidden, 1, last_logits) != 0) {
+            break;
         }
-        free_tensor(logits);
-
-        softmax(last_logits, 1);
+        logits_to_probs(last_logits->data, vocab_size, params, sort_scratch);
 
         // Sample the next token
-        float r = rand_float();
-        int next_token = 0;
-        float cumulative_prob = 0.0f;
-        for (int j = 0; j < last_logits->shape[1]; ++j) {
-            cumulative_prob += last_logits->data[j];
-            if (r <= cumulative_prob) {
-                next_token = j;
-                break;
-            }
-        }
-        free_tensor(last_logits);
+        int next_token = sample_from_distribution(last_logits->data, vocab_size, &rng);
 
         generated_sequence[current_len++] = next_token;
+        if (token_times) {
+            token_times[n_generated] = now_seconds();
+        }
+        n_generated++;
+        if (on_token && on_token(next_token, vocab->chars[next_token], user_data) != 0) {
+            cancelled = 1;
+            break;
+        }
+        if (i == max_new_tokens - 1) {
+            break;
+        }
+
+        // Decode incrementally while the sequence fits in the context window,
+        // then fall back to recomputing the last block_size tokens
+        if (current_len <= block_size) {
+            ok = model_forward_cached_hidden_into(model, generated_sequence + current_len - 1, 1, cache, hidden) == 0;
+        } else {
+            reset_kv_cache(cache);
+            ok = model_forward_cached_hidden_into(model, generated_sequence + current_len - block_size, block_size,
+                                                  cache, hidden) == 0;
+        }
+    }
+    free_tensor(hidden);
+    free_tensor(last_logits);
+    free(sort_scratch);
+    free_kv_cache(cache);
+
+    if (stats) {
+        summarize_generation(stats, start_time, prefill_end, token_times, n_generated);
+        stats->cancelled = cancelled;
+        free(token_times);
     }
 
     char* decoded_text = decode(generated_sequence, current_len, vocab);
     free(generated_sequence);
     return decoded_text;
 }
+
+// Token callback that writes each token's text to the file descriptor pointed to by
+// user_data; stops generation if the write fails (e.g. the reader went away).
+int write_token_to_fd(int token, const char* text, void* user_data) {
+    (void)token;
+    int fd = *(const int*)user_data;
+    size_t len = strlen(text);
+    while (len > 0) {
+        ssize_t n = write(fd, text, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        text += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to print the latency summary of a streamed generation
+void print_generation_stats(const GenerationStats* stats) {
+    printf("Streaming: %d tokens%s, prefill %.2f ms, time to first token %.2f ms, total %.2f ms\n",
+           stats->n_tokens, stats->cancelled ? " (cancelled)" : "",
+           stats->prefill_seconds * 1e3, stats->ttft_seconds * 1e3, stats->total_seconds * 1e3);
+    printf("Inter-token latency: mean %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           stats->itl_mean_seconds * 1e3, stats->itl_p50_seconds * 1e3,
+           stats->itl_p99_seconds * 1e3, stats->itl_max_seconds * 1e3);
+}
@@ -1,9 +1,54 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include <pthread.h>
 #include "tensor.h"
 #include "block.h"
 #include "data.h"
+#include "kv_cache.h"
+#include "rng.h"
+#include "graph.h"
+
+// Tile sizes of the fused lm_head + cross-entropy (CE_VOCAB_CHUNK is a multiple of GEMM_NR)
+#define CE_ROW_BLOCK 64
+#define CE_VOCAB_CHUNK 256
+
+// Compiled forward graphs kept per model; each holds its planned activation buffers
+// (about 140 MiB at the training shape), so the least recently used is dropped beyond this
+#define MODEL_GRAPH_CACHE 4
+
+// Sampling controls for generate_with_params
+typedef struct {
+    float temperature; // <= 0 means greedy
+    int top_k;         // 0 means the full vocabulary
+    uint32_t seed;     // Sampling stream id when has_seed is set
+    int has_seed;
+} SamplingParams;
+
+// Called with each sampled token and its text; return nonzero to cancel generation
+typedef int (*TokenCallback)(int token, const char* text, void* user_data);
+
+// Latency breakdown of one generate_stream call
+typedef struct {
+    int n_tokens;             // Tokens handed to the callback
+    int cancelled;            // The callback stopped generation early
+    double prefill_seconds;   // Prompt forward pass
+    double ttft_seconds;      // Call start to first token
+    double total_seconds;
+    double itl_mean_seconds;  // Inter-token latency between consecutive tokens
+    double itl_p50_seconds;
+    double itl_p99_seconds;
+    double itl_max_seconds;
+} GenerationStats;
+
+// A compiled forward graph for one input shape (see model_forward_fused)
+typedef struct ModelGraph {
+    Graph* graph;
+    int batch;
+    int block;
+    int with_logits;
+    struct ModelGraph* next;
+} ModelGraph;
 
 // The main Bigram Language Model
 typedef struct {
@@ -13,13 +58,39 @@ typedef struct {
     int n_layers;
     Linear* lm_head;
     LayerNorm* ln_final;
+    ModelGraph* graphs;         // Recorded on first use of each shape, most recently used first
+    pthread_mutex_t graph_lock; // Guards graphs; a graph runs under it
 } BigramLanguageModel;
 
 // Function prototypes
-BigramLanguageModel* create_bigram_language_model(int vocab_size, int n_embd, int block_size, int n_layer, int n_head);
+BigramLanguageModel* create_bigram_language_model(int vocab_size, int n_embd, int block_size, int n_layer, int n_head, int n_kv_head);
 void free_bigram_language_model(BigramLanguageModel* model);
+size_t model_ffn_weight_bytes(const BigramLanguageModel* model);
+int model_prune_ffn_2_4(BigramLanguageModel* model);
+Tensor* model_forward_hidden(BigramLanguageModel* model, const Tensor* idx);
 Tensor* model_forward(BigramLanguageModel* model, const Tensor* idx);
+Graph* model_record(BigramLanguageModel* model, int batch, int block, int with_logits);
+int model_forward_fused_into(BigramLanguageModel* model, const Tensor* idx, int with_logits, Tensor* out);
+Tensor* model_forward_hidden_fused(BigramLanguageModel* model, const Tensor* idx);
+Tensor* model_forward_fused(BigramLanguageModel* model, const Tensor* idx);
+Tensor* model_logits_last(BigramLanguageModel* model, const Tensor* hidden, int n_rows);
+int model_logits_last_into(BigramLanguageModel* model, const Tensor* hidden, int n_rows, Tensor* out);
+KVCache* create_model_kv_cache(BigramLanguageModel* model);
+Tensor* model_forward_cached_hidden(BigramLanguageModel* model, const int* tokens, int len, KVCache* cache);
+int model_forward_cached_hidden_into(BigramLanguageModel* model, const int* tokens, int len, KVCache* cache, Tensor* out);
+Tensor* model_forward_cached(BigramLanguageModel* model, const int* tokens, int len, KVCache* cache);
+Tensor* model_forward_tokens_hidden(BigramLanguageModel* model, const int* tokens, int len);
+Tensor* model_forward_tokens(BigramLanguageModel* model, const int* tokens, int len);
 float cross_entropy_loss(const Tensor* logits, const Tensor* targets);
+float lm_head_cross_entropy(Linear* lm_head, const Tensor* x, const Tensor* targets);
+int sample_from_distribution(const float* probs, int n, RngStream* rng);
 char* generate(BigramLanguageModel* model, Vocabulary* vocab, const char* start_text, int max_new_tokens);
+char* generate_with_params(BigramLanguageModel* model, Vocabulary* vocab, const char* start_text,
+                           int max_new_tokens, const SamplingParams* params);
+char* generate_stream(BigramLanguageModel* model, Vocabulary* vocab, const char* start_text,
+                      int max_new_tokens, const SamplingParams* params,
+                      TokenCallback on_token, void* user_data, GenerationStats* stats);
+int write_token_to_fd(int token, const char* text, void* user_data);
+void print_generation_stats(const GenerationStats* stats);
 
 #endif // MODEL_H
@@ -0,0 +1,387 @@
+#define _GNU_SOURCE
+#include "pipeline.h"
+#include "spsc_queue.h"
+#include "gemm_tune.h"
+#include "threads.h"
+#include <float.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A group of sequences travelling through the stages together
+typedef struct {
+    int first_seq;
+    int n_seqs;
+    Tensor* x; // Residual streams of the sequences stacked row-wise: (sum of lens, n_embd)
+} MicroBatch;
+
+typedef struct {
+    BigramLanguageModel* model;
+    const int* const* tokens;
+    const int* lens;
+    int n_seqs;
+    int micro_batch;
+    int n_micro_batches;
+    int n_stages;
+    int cores_per_stage;
+    int n_cores;
+    int cores[CPU_SETSIZE]; // CPU ids the process may run on, in increasing order
+    const int* first_layer;
+    // queues[s] feeds stage s; queues[0] carries emptied micro-batches from the
+    // last stage back to the first, so every queue has one producer and one consumer
+    SpscQueue** queues;
+    PipelineSink sink;
+    void* ctx;
+    double* busy;
+    double* wait;
+    atomic_int failed; // Set by any stage whose forward pass failed
+} Pipeline;
+
+typedef struct {
+    Pipeline* pipeline;
+    int stage;
+} StageArg;
+
+// Function to pop from a queue, adding the time spent waiting to *wait
+static MicroBatch* pop_waiting(SpscQueue* queue, double* wait) {
+    void* item;
+    if (spsc_try_pop(queue, &item) == 0) {
+        return (MicroBatch*)item;
+    }
+    double start = now_seconds();
+    while (spsc_try_pop(queue, &item) != 0) {
+        sched_yield();
+    }
+    *wait += now_seconds() - start;
+    return (MicroBatch*)item;
+}
+
+// Function to push to a queue, adding the time spent waiting to *wait
+static void push_waiting(SpscQueue* queue, MicroBatch* mb, double* wait) {
+    if (spsc_try_push(queue, mb) == 0) {
+        return;
+    }
+    double start = now_seconds();
+    while (spsc_try_push(queue, mb) != 0) {
+        sched_yield();
+    }
+    *wait += now_seconds() - start;
+}
+
+// Function to list the CPUs the process may run on (honouring taskset and cpusets)
+static int allowed_cores(int* cores) {
+    cpu_set_t set;
+    int n = 0;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cores[n++] = cpu;
+            }
+        }
+    }
+    if (n == 0) {
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        n = (n < 1) ? 1 : (n > CPU_SETSIZE ? CPU_SETSIZE : n);
+        for (int cpu = 0; cpu < n; ++cpu) {
+            cores[cpu] = cpu;
+        }
+    }
+    return n;
+}
+
+// Function to restrict the calling thread to the cores of its stage
+static void pin_to_core_group(int stage, int cores_per_stage, const int* cores) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c = 0; c < cores_per_stage; ++c) {
+        CPU_SET(cores[stage * cores_per_stage + c], &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Function to load the embeddings of a micro-batch's sequences (first stage only)
+static void embed_micro_batch(Pipeline* p, MicroBatch* mb, int index) {
+    BigramLanguageModel* model = p->model;
+    int n_embd = model->token_embedding_table->shape[1];
+    mb->first_seq = index * p->micro_batch;
+    mb->n_seqs = (p->n_seqs - mb->first_seq < p->micro_batch) ? p->n_seqs - mb->first_seq : p->micro_batch;
+    int n_rows = 0;
+    for (int i = 0; i < mb->n_seqs; ++i) {
+        n_rows += p->lens[mb->first_seq + i];
+    }
+    int shape[] = {n_rows, n_embd};
+    mb->x = resize_tensor(mb->x, shape, 2);
+
+    float* row = mb->x->data;
+    for (int i = 0; i < mb->n_seqs; ++i) {
+        const int* tokens = p->tokens[mb->first_seq + i];
+        int len = p->lens[mb->first_seq + i];
+        for (int t = 0; t < len; ++t, row += n_embd) {
+            const float* tok = model->token_embedding_table->data + (size_t)tokens[t] * n_embd;
+            const float* pos = model->position_embedding_table->data + (size_t)t * n_embd;
+            for (int c = 0; c < n_embd; ++c) {
+                row[c] = tok[c] + pos[c];
+            }
+        }
+    }
+}
+
+// Stage thread: runs its blocks over every micro-batch in order
+static void* stage_main(void* arg) {
+    Pipeline* p = ((StageArg*)arg)->pipeline;
+    int s = ((StageArg*)arg)->stage;
+    int last = (s == p->n_stages - 1);
+    if (p->cores_per_stage > 0) {
+        pin_to_core_group(s, p->cores_per_stage, p->cores);
+    }
+    // Stages run side by side; each parallelizes only over its own share of the cores,
+    // including the GEMMs the tuning cache has no entry for
+    set_thread_budget(p->cores_per_stage > 0 ? p->cores_per_stage : 1);
+    gemm_set_default_threads(get_thread_budget());
+
+    BigramLanguageModel* model = p->model;
+    Workspace* ws = create_workspace();
+    Tensor* hidden = NULL;
+    SpscQueue* in = p->queues[s];
+    SpscQueue* out = p->queues[(s + 1) % p->n_stages];
+
+    for (int m = 0; m < p->n_micro_batches; ++m) {
+        MicroBatch* mb = pop_waiting(in, &p->wait[s]);
+        double start = now_seconds();
+
+        if (s == 0) {
+            embed_micro_batch(p, mb, m);
+        }
+        // The whole micro-batch goes through each block at once
+        const int* lens = p->lens + mb->first_seq;
+        for (int l = p->first_layer[s]; l < p->first_layer[s + 1]; ++l) {
+            if (block_forward_batched_into(model->blocks[l], mb->x, lens, mb->n_seqs, ws) != 0) {
+                atomic_store(&p->failed, 1);
+            }
+        }
+        if (last) {
+            hidden = resize_tensor(hidden, mb->x->shape, 2);
+            if (layer_norm_forward_into(model->ln_final, mb->x, hidden) == 0) {
+                int n_embd = hidden->shape[1];
+                float* rows = hidden->data;
+                for (int i = 0; i < mb->n_seqs; ++i) {
+                    // A borrowed (len, n_embd) view of sequence i's rows
+                    int shape[] = {lens[i], n_embd};
+                    Tensor seq_hidden = tensor_view(rows, shape, 2);
+                    p->sink(mb->first_seq + i, &seq_hidden, p->ctx);
+                    rows += (size_t)lens[i] * n_embd;
+                }
+            } else {
+                atomic_store(&p->failed, 1);
+            }
+        }
+
+        p->busy[s] += now_seconds() - start;
+        push_waiting(out, mb, &p->wait[s]);
+    }
+
+    if (hidden) {
+        free_tensor(hidden);
+    }
+    free_workspace(ws);
+    return NULL;
+}
+
+// Function to split the blocks into contiguous stages with the smallest maximum cost
+// Costs are per-token multiply-adds: each block does 12 * C^2 in its projections and
+// feed-forward plus about T * C in attention; the last stage also runs lm_head (C * V).
+static void balance_stages(BigramLanguageModel* model, int avg_len, int n_stages, int* first_layer, double* share) {
+    int L = model->n_layers;
+    double C = model->token_embedding_table->shape[1];
+    double V = model->lm_head->weights->shape[1];
+    double block_cost = 12.0 * C * C + avg_len * C;
+    double head_cost = C * V;
+
+    // best[s][l]: smallest max stage cost for blocks [0, l) split over s + 1 stages
+    double best[n_stages][L + 1];
+    int cut[n_stages][L + 1];
+    for (int l = 0; l <= L; ++l) {
+        best[0][l] = l * block_cost + (n_stages == 1 ? head_cost : 0.0);
+        cut[0][l] = 0;
+    }
+    for (int s = 1; s < n_stages; ++s) {
+        double tail_extra = (s == n_stages - 1) ? head_cost : 0.0;
+        for (int l = 0; l <= L; ++l) {
+            best[s][l] = DBL_MAX;
+            cut[s][l] = s;
+            // Every stage keeps at least one block
+            for (int k = s; k < l; ++k) {
+                double stage_cost = (l - k) * block_cost + tail_extra;
+                double cost = best[s - 1][k] > stage_cost ? best[s - 1][k] : stage_cost;
+                if (cost < best[s][l]) {
+                    best[s][l] = cost;
+                    cut[s][l] = k;
+                }
+            }
+        }
+    }
+
+    first_layer[n_stages] = L;
+    for (int s = n_stages - 1; s > 0; --s) {
+        first_layer[s] = cut[s][first_layer[s + 1]];
+    }
+    first_layer[0] = 0;
+
+    double total = L * block_cost + head_cost;
+    for (int s = 0; s < n_stages; ++s) {
+        double cost = (first_layer[s + 1] - first_layer[s]) * block_cost + (s == n_stages - 1 ? head_cost : 0.0);
+        share[s] = cost / total;
+    }
+}
+
+// Function to run the model over many independent sequences with layer pipelining
+// The blocks are split into n_stages contiguous stages balanced by estimated cost,
+// each stage runs on its own thread pinned to a group of cores, and sequences are
+// cut into micro-batches of micro_batch that flow through the stages over
+// lock-free SPSC queues, so different stages work on different micro-batches at
+// once. Every core then only streams its own stage's weights. A stage runs each
+// block once per micro-batch, with the sequences' rows stacked into its GEMMs, and
+// splits attention and GEMM rows over the cores of its group. Sequences must fit
+// in block_size. sink receives the final hidden states in sequence order. stats may
+// be NULL; otherwise it must be released with free_pipeline_stats.
+int pipeline_forward(BigramLanguageModel* model, const int* const* tokens, const int* lens, int n_seqs,
+                     int n_stages, int micro_batch, PipelineSink sink, void* ctx, PipelineStats* stats) {
+    int block_size = model->position_embedding_table->shape[0];
+    for (int i = 0; i < n_seqs; ++i) {
+        if (lens[i] <= 0 || lens[i] > block_size) {
+            fprintf(stderr, "Sequence %d does not fit in the context window.\n", i);
+            return -1;
+        }
+    }
+    if (n_seqs <= 0) {
+        return 0;
+    }
+    if (n_stages > model->n_layers) {
+        n_stages = model->n_layers;
+    }
+    if (n_stages < 1) {
+        n_stages = 1;
+    }
+    if (micro_batch < 1) {
+        micro_batch = 1;
+    }
+
+    Pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.model = model;
+    p.tokens = tokens;
+    p.lens = lens;
+    p.n_seqs = n_seqs;
+    p.micro_batch = micro_batch;
+    p.n_micro_batches = (n_seqs + micro_batch - 1) / micro_batch;
+    p.n_stages = n_stages;
+    p.sink = sink;
+    p.ctx = ctx;
+    p.busy = (double*)calloc(n_stages, sizeof(double));
+    p.wait = (double*)calloc(n_stages, sizeof(double));
+    atomic_init(&p.failed, 0);
+
+    // Pin only when every stage can get a core of its own
+    p.n_cores = allowed_cores(p.cores);
+    p.cores_per_stage = (p.n_cores >= n_stages) ? p.n_cores / n_stages : 0;
+
+    long avg_len = 0;
+    for (int i = 0; i < n_seqs; ++i) {
+        avg_len += lens[i];
+    }
+    int* first_layer = (int*)malloc((n_stages + 1) * sizeof(int));
+    double* share = (double*)malloc(n_stages * sizeof(double));
+    balance_stages(model, (int)(avg_len / n_seqs), n_stages, first_layer, share);
+    p.first_layer = first_layer;
+
+    // Enough micro-batches in flight for every stage plus one buffered per queue
+    int pool_size = PIPELINE_DEPTH * n_stages;
+    if (pool_size > p.n_micro_batches) {
+        pool_size = p.n_micro_batches;
+    }
+    p.queues = (SpscQueue**)malloc(n_stages * sizeof(SpscQueue*));
+    for (int s = 0; s < n_stages; ++s) {
+        p.queues[s] = create_spsc_queue(pool_size);
+    }
+    MicroBatch* pool = (MicroBatch*)calloc(pool_size, sizeof(MicroBatch));
+    for (int b = 0; b < pool_size; ++b) {
+        spsc_try_push(p.queues[0], &pool[b]);
+    }
+
+    double start = now_seconds();
+    pthread_t threads[n_stages];
+    StageArg args[n_stages];
+    for (int s = 0; s < n_stages; ++s) {
+        args[s].pipeline = &p;
+        args[s].stage = s;
+        pthread_create(&threads[s], NULL, stage_main, &args[s]);
+    }
+    for (int s = 0; s < n_stages; ++s) {
+        pthread_join(threads[s], NULL);
+    }
+    double seconds = now_seconds() - start;
+
+    for (int b = 0; b < pool_size; ++b) {
+        if (pool[b].x) {
+            free_tensor(pool[b].x);
+        }
+    }
+    free(pool);
+    for (int s = 0; s < n_stages; ++s) {
+        free_spsc_queue(p.queues[s]);
+    }
+    free(p.queues);
+
+    if (stats) {
+        stats->n_stages = n_stages;
+        stats->micro_batch = micro_batch;
+        stats->n_micro_batches = p.n_micro_batches;
+        stats->cores_per_stage = p.cores_per_stage;
+        stats->first_layer = first_layer;
+        stats->est_share = share;
+        stats->busy_seconds = p.busy;
+        stats->wait_seconds = p.wait;
+        stats->seconds = seconds;
+    } else {
+        free(first_layer);
+        free(share);
+        free(p.busy);
+        free(p.wait);
+    }
+    return atomic_load(&p.failed) ? -1 : 0;
+}
+
+// Function to free the arrays of a PipelineStats
+void free_pipeline_stats(PipelineStats* stats) {
+    free(stats->first_layer);
+    free(stats->est_share);
+    free(stats->busy_seconds);
+    free(stats->wait_seconds);
+}
+
+// Function to print stage balance and bubble time of a pipelined run
+void print_pipeline_stats(const PipelineStats* stats) {
+    printf("Pipeline: %d stages, %d micro-batches of %d, ", stats->n_stages, stats->n_micro_batches, stats->micro_batch);
+    if (stats->cores_per_stage > 0) {
+        printf("%d core(s) per stage\n", stats->cores_per_stage);
+    } else {
+        printf("not pinned (fewer cores than stages)\n");
+    }
+    double total_busy = 0.0, total_wait = 0.0;
+    for (int s = 0; s < stats->n_stages; ++s) {
+        double busy = stats->busy_seconds[s];
+        double wait = stats->wait_seconds[s];
+        printf("  stage %d: blocks %d-%d%s, est %.1f%%, busy %.2fs, bubble %.2fs (%.1f%%)\n",
+               s, stats->first_layer[s], stats->first_layer[s + 1] - 1,
+               s == stats->n_stages - 1 ? " + lm_head" : "", stats->est_share[s] * 100.0,
+               busy, wait, (busy + wait) > 0.0 ? 100.0 * wait / (busy + wait) : 0.0);
+        total_busy += busy;
+        total_wait += wait;
+    }
+    printf("  total %.2fs, bubble %.1f%% of stage time\n", stats->seconds,
+           (total_busy + total_wait) > 0.0 ? 100.0 * total_wait / (total_busy + total_wait) : 0.0);
+}
@@ -0,0 +1,32 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "model.h"
+
+// Micro-batches buffered between two adjacent stages (and in flight overall per stage)
+#define PIPELINE_DEPTH 2
+
+// Called by the last stage with the (len, n_embd) final hidden states of every
+// sequence, in sequence order. hidden is only valid during the call.
+typedef void (*PipelineSink)(int seq, const Tensor* hidden, void* ctx);
+
+// Layout and timing of one pipelined forward pass
+typedef struct {
+    int n_stages;
+    int micro_batch;       // Sequences per micro-batch
+    int n_micro_batches;
+    int cores_per_stage;   // Size of the core group each stage is pinned to, 0 if not pinned
+    int* first_layer;      // Stage s runs blocks [first_layer[s], first_layer[s + 1])
+    double* est_share;     // Estimated share of the work per stage (the last one includes lm_head)
+    double* busy_seconds;  // Time each stage spent computing
+    double* wait_seconds;  // Bubble: time starved of input or blocked on a full queue
+    double seconds;
+} PipelineStats;
+
+// Function prototypes
+int pipeline_forward(BigramLanguageModel* model, const int* const* tokens, const int* lens, int n_seqs,
+                     int n_stages, int micro_batch, PipelineSink sink, void* ctx, PipelineStats* stats);
+void free_pipeline_stats(PipelineStats* stats);
+void print_pipeline_stats(const PipelineStats* stats);
+
+#endif // PIPELINE_H
@@ -0,0 +1,317 @@
+#include "prefix_cache.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_PREFIX_CACHE_BYTES ((size_t)64 << 20)
+
+// A radix-tree node: an edge of tokens plus the keys/values of those positions
+// kv holds, per layer, n_tokens key rows followed by n_tokens value rows.
+typedef struct PrefixNode {
+    int* tokens;
+    int n_tokens;
+    float* kv;
+    struct PrefixNode* parent;
+    struct PrefixNode** children;
+    int n_children;
+    unsigned long last_used;
+} PrefixNode;
+
+// One radix tree per model
+typedef struct PrefixTree {
+    const void* model;
+    int n_layers;
+    int kv_dim;
+    PrefixNode root;
+    struct PrefixTree* next;
+} PrefixTree;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static PrefixTree* trees = NULL;
+static unsigned long clock_tick = 0;
+static PrefixCacheStats stats = {0, 0, 0, 0, 0, 0, 0, DEFAULT_PREFIX_CACHE_BYTES};
+
+// Function to get the number of bytes held by a node
+static size_t node_bytes(const PrefixTree* tree, int n_tokens) {
+    return (size_t)n_tokens * (sizeof(int) + 2 * (size_t)tree->n_layers * tree->kv_dim * sizeof(float));
+}
+
+// Function to get the key row of a position inside a node
+static float* node_k(const PrefixTree* tree, const PrefixNode* node, int layer, int t) {
+    return node->kv + ((size_t)layer * 2 * node->n_tokens + t) * tree->kv_dim;
+}
+
+// Function to get the value row of a position inside a node
+static float* node_v(const PrefixTree* tree, const PrefixNode* node, int layer, int t) {
+    return node->kv + ((size_t)layer * 2 * node->n_tokens + node->n_tokens + t) * tree->kv_dim;
+}
+
+// Function to create a node holding positions [pos, pos + n_tokens) taken from cache
+static PrefixNode* create_node(PrefixTree* tree, const int* tokens, int n_tokens, const KVCache* cache, int pos) {
+    PrefixNode* node = (PrefixNode*)calloc(1, sizeof(PrefixNode));
+    node->n_tokens = n_tokens;
+    node->tokens = (int*)malloc(n_tokens * sizeof(int));
+    memcpy(node->tokens, tokens, n_tokens * sizeof(int));
+    node->kv = (float*)malloc((size_t)tree->n_layers * 2 * n_tokens * tree->kv_dim * sizeof(float));
+    size_t row_bytes = (size_t)tree->kv_dim * sizeof(float);
+    for (int l = 0; l < tree->n_layers; ++l) {
+        memcpy(node_k(tree, node, l, 0), cache->k[l] + (size_t)pos * tree->kv_dim, n_tokens * row_bytes);
+        memcpy(node_v(tree, node, l, 0), cache->v[l] + (size_t)pos * tree->kv_dim, n_tokens * row_bytes);
+    }
+    stats.bytes_used += node_bytes(tree, n_tokens);
+    return node;
+}
+
+// Function to free a node and its whole subtree
+static void free_subtree(PrefixTree* tree, PrefixNode* node) {
+    for (int i = 0; i < node->n_children; ++i) {
+        free_subtree(tree, node->children[i]);
+    }
+    free(node->children);
+    free(node->tokens);
+    free(node->kv);
+    stats.bytes_used -= node_bytes(tree, node->n_tokens);
+    free(node);
+}
+
+// Function to attach a child to a node
+static void add_child(PrefixNode* parent, PrefixNode* child) {
+    parent->children = (PrefixNode**)realloc(parent->children, (parent->n_children + 1) * sizeof(PrefixNode*));
+    parent->children[parent->n_children++] = child;
+    child->parent = parent;
+}
+
+// Function to detach a child from its parent
+static void remove_child(PrefixNode* parent, PrefixNode* child) {
+    for (int i = 0; i < parent->n_children; ++i) {
+        if (parent->children[i] == child) {
+            parent->children[i] = parent->children[--parent->n_children];
+            return;
+        }
+    }
+}
+
+// Function to find the child whose edge starts with token
+static PrefixNode* find_child(const PrefixNode* node, int token) {
+    for (int i = 0; i < node->n_children; ++i) {
+        if (node->children[i]->tokens[0] == token) {
+            return node->children[i];
+        }
+    }
+    return NULL;
+}
+
+// Function to split a node so that its edge is exactly `at` tokens long
+static void split_node(PrefixTree* tree, PrefixNode* node, int at) {
+    int tail_len = node->n_tokens - at;
+    PrefixNode* tail = (PrefixNode*)calloc(1, sizeof(PrefixNode));
+    tail->n_tokens = tail_len;
+    tail->tokens = (int*)malloc(tail_len * sizeof(int));
+    memcpy(tail->tokens, node->tokens + at, tail_len * sizeof(int));
+    tail->kv = (float*)malloc((size_t)tree->n_layers * 2 * tail_len * tree->kv_dim * sizeof(float));
+    tail->last_used = node->last_used;
+
+    float* head_kv = (float*)malloc((size_t)tree->n_layers * 2 * at * tree->kv_dim * sizeof(float));
+    size_t row_bytes = (size_t)tree->kv_dim * sizeof(float);
+    for (int l = 0; l < tree->n_layers; ++l) {
+        memcpy(node_k(tree, tail, l, 0), node_k(tree, node, l, at), tail_len * row_bytes);
+        memcpy(node_v(tree, tail, l, 0), node_v(tree, node, l, at), tail_len * row_bytes);
+        float* head_k = head_kv + (size_t)l * 2 * at * tree->kv_dim;
+        memcpy(head_k, node_k(tree, node, l, 0), at * row_bytes);
+        memcpy(head_k + (size_t)at * tree->kv_dim, node_v(tree, node, l, 0), at * row_bytes);
+    }
+    free(node->kv);
+    node->kv = head_kv;
+    node->n_tokens = at;
+
+    // The tail inherits the children
+    tail->children = node->children;
+    tail->n_children = node->n_children;
+    for (int i = 0; i < tail->n_children; ++i) {
+        tail->children[i]->parent = tail;
+    }
+    node->children = NULL;
+    node->n_children = 0;
+    add_child(node, tail);
+}
+
+// Function to find the tree of a model, optionally creating it
+static PrefixTree* find_tree(const void* model, int n_layers, int kv_dim, int create) {
+    for (PrefixTree* tree = trees; tree; tree = tree->next) {
+        if (tree->model == model) {
+            return tree;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    PrefixTree* tree = (PrefixTree*)calloc(1, sizeof(PrefixTree));
+    tree->model = model;
+    tree->n_layers = n_layers;
+    tree->kv_dim = kv_dim;
+    tree->next = trees;
+    trees = tree;
+    return tree;
+}
+
+// Function to find the least recently used leaf of a subtree
+static void find_lru_leaf(PrefixNode* node, PrefixNode** best, PrefixTree* tree, PrefixTree** best_tree) {
+    for (int i = 0; i < node->n_children; ++i) {
+        PrefixNode* child = node->children[i];
+        if (child->n_children == 0) {
+            if (!*best || child->last_used < (*best)->last_used) {
+                *best = child;
+                *best_tree = tree;
+            }
+        } else {
+            find_lru_leaf(child, best, tree, best_tree);
+        }
+    }
+}
+
+// Function to evict least recently used leaves until the budget is met
+static void evict_to_budget(void) {
+    while (stats.bytes_used > stats.budget_bytes) {
+        PrefixNode* victim = NULL;
+        PrefixTree* victim_tree = NULL;
+        for (PrefixTree* tree = trees; tree; tree = tree->next) {
+            find_lru_leaf(&tree->root, &victim, tree, &victim_tree);
+        }
+        if (!victim) {
+            break;
+        }
+        remove_child(victim->parent, victim);
+        free_subtree(victim_tree, victim);
+        stats.evictions++;
+    }
+}
+
+// Function to set the memory budget of the cache (0 disables caching)
+void prefix_cache_set_budget(size_t budget_bytes) {
+    pthread_mutex_lock(&cache_lock);
+    stats.budget_bytes = budget_bytes;
+    evict_to_budget();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Function to copy the keys/values of the longest cached prefix of tokens into out
+// At most max_len positions are reused; returns the number of positions copied,
+// which is also left in out->len.
+int prefix_cache_lookup(const void* model, const int* tokens, int max_len, KVCache* out) {
+    pthread_mutex_lock(&cache_lock);
+    stats.lookups++;
+    out->len = 0;
+
+    PrefixTree* tree = find_tree(model, out->n_layers, out->kv_dim, 0);
+    if (max_len > out->capacity) {
+        max_len = out->capacity;
+    }
+
+    int matched = 0;
+    unsigned long tick = ++clock_tick;
+    PrefixNode* node = (tree && max_len > 0) ? find_child(&tree->root, tokens[0]) : NULL;
+    size_t row_bytes = (size_t)out->kv_dim * sizeof(float);
+    while (node && matched < max_len) {
+        int n = 0;
+        while (n < node->n_tokens && matched + n < max_len && node->tokens[n] == tokens[matched + n]) {
+            n++;
+        }
+        for (int l = 0; l < out->n_layers; ++l) {
+            memcpy(out->k[l] + (size_t)matched * out->kv_dim, node_k(tree, node, l, 0), n * row_bytes);
+            memcpy(out->v[l] + (size_t)matched * out->kv_dim, node_v(tree, node, l, 0), n * row_bytes);
+        }
+        node->last_used = tick;
+        matched += n;
+        if (n < node->n_tokens || matched >= max_len) {
+            break;
+        }
+        node = find_child(node, tokens[matched]);
+    }
+
+    if (matched > 0) {
+        stats.hits++;
+        stats.hit_tokens += matched;
+    } else {
+        stats.misses++;
+    }
+    out->len = matched;
+    pthread_mutex_unlock(&cache_lock);
+    return matched;
+}
+
+// Function to record the keys/values of positions [0, len) of a token sequence
+void prefix_cache_insert(const void* model, const int* tokens, int len, const KVCache* cache) {
+    if (len > cache->len) {
+        len = cache->len;
+    }
+    pthread_mutex_lock(&cache_lock);
+    if (stats.budget_bytes == 0 || len <= 0) {
+        pthread_mutex_unlock(&cache_lock);
+        return;
+    }
+    stats.inserts++;
+
+    PrefixTree* tree = find_tree(model, cache->n_layers, cache->kv_dim, 1);
+    PrefixNode* parent = &tree->root;
+    unsigned long tick = ++clock_tick;
+    int pos = 0;
+    while (pos < len) {
+        PrefixNode* node = find_child(parent, tokens[pos]);
+        if (!node) {
+            PrefixNode* leaf = create_node(tree, tokens + pos, len - pos, cache, pos);
+            leaf->last_used = tick;
+            add_child(parent, leaf);
+            break;
+        }
+        int n = 0;
+        while (n < node->n_tokens && pos + n < len && node->tokens[n] == tokens[pos + n]) {
+            n++;
+        }
+        if (n < node->n_tokens) {
+            split_node(tree, node, n);
+        }
+        node->last_used = tick;
+        pos += n;
+        parent = node;
+    }
+
+    evict_to_budget();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Function to drop every entry of a model (called when the model is freed)
+void prefix_cache_drop_model(const void* model) {
+    pthread_mutex_lock(&cache_lock);
+    PrefixTree** link = &trees;
+    while (*link) {
+        PrefixTree* tree = *link;
+        if (tree->model == model) {
+            for (int i = 0; i < tree->root.n_children; ++i) {
+                free_subtree(tree, tree->root.children[i]);
+            }
+            free(tree->root.children);
+            *link = tree->next;
+            free(tree);
+        } else {
+            link = &tree->next;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Function to get a snapshot of the cache counters
+PrefixCacheStats prefix_cache_get_stats(void) {
+    pthread_mutex_lock(&cache_lock);
+    PrefixCacheStats snapshot = stats;
+    pthread_mutex_unlock(&cache_lock);
+    return snapshot;
+}
+
+// Function to print the cache counters
+void print_prefix_cache_stats(void) {
+    PrefixCacheStats s = prefix_cache_get_stats();
+    printf("Prefix cache: %ld lookups, %ld hits, %ld misses, %ld positions reused, %ld evictions, %.1f/%.1f MB\n",
+           s.lookups, s.hits, s.misses, s.hit_tokens, s.evictions,
+           s.bytes_used / 1048576.0, s.budget_bytes / 1048576.0);
+}
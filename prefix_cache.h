@@ -0,0 +1,29 @@
+#ifndef PREFIX_CACHE_H
+#define PREFIX_CACHE_H
+
+#include <stddef.h>
+#include "kv_cache.h"
+
+// Hit/miss counters of the prefix cache
+typedef struct {
+    long lookups;
+    long hits;          // Lookups that reused at least one cached position
+    long misses;
+    long hit_tokens;    // Positions served from the cache instead of recomputed
+    long inserts;
+    long evictions;     // Nodes dropped to stay within the memory budget
+    size_t bytes_used;
+    size_t budget_bytes;
+} PrefixCacheStats;
+
+// Function prototypes
+// The cache is process-wide and shared by every generate() call; entries are
+// keyed by the owning model so different models never share activations.
+void prefix_cache_set_budget(size_t budget_bytes);
+int prefix_cache_lookup(const void* model, const int* tokens, int max_len, KVCache* out);
+void prefix_cache_insert(const void* model, const int* tokens, int len, const KVCache* cache);
+void prefix_cache_drop_model(const void* model);
+PrefixCacheStats prefix_cache_get_stats(void);
+void print_prefix_cache_stats(void);
+
+#endif // PREFIX_CACHE_H
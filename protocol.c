@@ -0,0 +1,187 @@
+#include "protocol.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Function to write exactly len bytes, returning 0 on success
+static int write_all(int fd, const void* buf, size_t len) {
+    const char* p = (const char*)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to read exactly len bytes, returning 0 on success and -1 on EOF/error
+static int read_all(int fd, void* buf, size_t len) {
+    char* p = (char*)buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to send one frame
+static int write_frame(int fd, const char* payload, uint32_t len) {
+    uint32_t header = htonl(len);
+    if (write_all(fd, &header, sizeof(header)) != 0) {
+        return -1;
+    }
+    return write_all(fd, payload, len);
+}
+
+// Function to receive one frame into a malloc'd buffer
+static int read_frame(int fd, char** payload, uint32_t* len) {
+    uint32_t header;
+    if (read_all(fd, &header, sizeof(header)) != 0) {
+        return -1;
+    }
+    *len = ntohl(header);
+    if (*len > MAX_FRAME_BYTES) {
+        return -1;
+    }
+    *payload = (char*)malloc(*len + 1);
+    if (read_all(fd, *payload, *len) != 0) {
+        free(*payload);
+        return -1;
+    }
+    return 0;
+}
+
+static void put_u32(char** p, uint32_t v) {
+    uint32_t be = htonl(v);
+    memcpy(*p, &be, 4);
+    *p += 4;
+}
+
+static uint32_t get_u32(const char** p) {
+    uint32_t be;
+    memcpy(&be, *p, 4);
+    *p += 4;
+    return ntohl(be);
+}
+
+static void put_f32(char** p, float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    put_u32(p, bits);
+}
+
+static float get_f32(const char** p) {
+    uint32_t bits = get_u32(p);
+    float f;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+
+// Function to send a request
+int send_request(int fd, const GenRequest* request) {
+    uint32_t prompt_len = request->prompt ? strlen(request->prompt) : 0;
+    uint32_t len = REQUEST_HEADER_BYTES + prompt_len;
+    char* payload = (char*)malloc(len);
+    char* p = payload;
+    put_u32(&p, request->type);
+    put_u32(&p, request->max_new_tokens);
+    put_f32(&p, request->temperature);
+    put_u32(&p, request->top_k);
+    put_u32(&p, request->has_seed);
+    put_u32(&p, request->seed);
+    put_u32(&p, prompt_len);
+    memcpy(p, request->prompt, prompt_len);
+    int rc = write_frame(fd, payload, len);
+    free(payload);
+    return rc;
+}
+
+// Function to receive a request; request->prompt must be freed by the caller
+int recv_request(int fd, GenRequest* request) {
+    char* payload;
+    uint32_t len;
+    if (read_frame(fd, &payload, &len) != 0) {
+        return -1;
+    }
+    if (len < REQUEST_HEADER_BYTES) {
+        free(payload);
+        return -1;
+    }
+    const char* p = payload;
+    request->type = get_u32(&p);
+    request->max_new_tokens = get_u32(&p);
+    request->temperature = get_f32(&p);
+    request->top_k = get_u32(&p);
+    request->has_seed = get_u32(&p);
+    request->seed = get_u32(&p);
+    uint32_t prompt_len = get_u32(&p);
+    if (prompt_len != len - REQUEST_HEADER_BYTES) {
+        free(payload);
+        return -1;
+    }
+    request->prompt = (char*)malloc(prompt_len + 1);
+    memcpy(request->prompt, p, prompt_len);
+    request->prompt[prompt_len] = '\0';
+    free(payload);
+    return 0;
+}
+
+// Function to send a response
+int send_response(int fd, const GenResponse* response) {
+    uint32_t text_len = response->text ? strlen(response->text) : 0;
+    uint32_t len = RESPONSE_HEADER_BYTES + text_len;
+    char* payload = (char*)malloc(len);
+    char* p = payload;
+    put_u32(&p, response->status);
+    put_f32(&p, response->queue_ms);
+    put_f32(&p, response->compute_ms);
+    put_u32(&p, response->n_tokens);
+    put_u32(&p, text_len);
+    memcpy(p, response->text, text_len);
+    int rc = write_frame(fd, payload, len);
+    free(payload);
+    return rc;
+}
+
+// Function to receive a response; response->text must be freed by the caller
+int recv_response(int fd, GenResponse* response) {
+    char* payload;
+    uint32_t len;
+    if (read_frame(fd, &payload, &len) != 0) {
+        return -1;
+    }
+    if (len < RESPONSE_HEADER_BYTES) {
+        free(payload);
+        return -1;
+    }
+    const char* p = payload;
+    response->status = get_u32(&p);
+    response->queue_ms = get_f32(&p);
+    response->compute_ms = get_f32(&p);
+    response->n_tokens = get_u32(&p);
+    uint32_t text_len = get_u32(&p);
+    if (text_len != len - RESPONSE_HEADER_BYTES) {
+        free(payload);
+        return -1;
+    }
+    response->text = (char*)malloc(text_len + 1);
+    memcpy(response->text, p, text_len);
+    response->text[text_len] = '\0';
+    free(payload);
+    return 0;
+}
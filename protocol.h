@@ -0,0 +1,58 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+// Wire protocol between the inference daemon and its clients
+//
+// Every message is a frame: a 4-byte big-endian payload length followed by the
+// payload. All integers in payloads are big-endian u32, floats are sent as
+// their IEEE-754 bit pattern in a u32.
+//   request:  type, max_new_tokens, temperature, top_k, has_seed, seed, prompt_len, prompt bytes
+//   response: status, queue_ms, compute_ms, n_tokens, text_len, text bytes
+// A connection may carry any number of request/response pairs. A streamed
+// generation answers with one STATUS_TOKEN response per token before the final one.
+
+#define MAX_FRAME_BYTES (1 << 20)
+
+// Bytes of the fixed fields in front of the prompt / text
+#define REQUEST_HEADER_BYTES (7 * 4)
+#define RESPONSE_HEADER_BYTES (5 * 4)
+
+typedef enum {
+    MSG_GENERATE = 1,        // Generate text from a prompt
+    MSG_STATS = 2,           // Return the server's latency summary as text
+    MSG_GENERATE_STREAM = 3  // Like MSG_GENERATE, but send each token as it is sampled
+} MessageType;
+
+typedef enum {
+    STATUS_OK = 0,
+    STATUS_ERROR = 1, // text holds the error message
+    STATUS_TOKEN = 2  // Streamed token; text holds its characters, more responses follow
+} ResponseStatus;
+
+typedef struct {
+    uint32_t type;
+    uint32_t max_new_tokens;
+    float temperature;
+    uint32_t top_k;
+    uint32_t has_seed;
+    uint32_t seed;
+    char* prompt; // NUL-terminated
+} GenRequest;
+
+typedef struct {
+    uint32_t status;
+    float queue_ms;   // Time between the request arriving and a session starting it
+    float compute_ms; // Time spent generating
+    uint32_t n_tokens;
+    char* text;       // NUL-terminated
+} GenResponse;
+
+// Function prototypes
+int send_request(int fd, const GenRequest* request);
+int recv_request(int fd, GenRequest* request);
+int send_response(int fd, const GenResponse* response);
+int recv_response(int fd, GenResponse* response);
+
+#endif // PROTOCOL_H
@@ -0,0 +1,248 @@
+#include "rng.h"
+#include "threads.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+// Number of blocks generated together by the bulk path
+#define PHILOX_LANES 8
+
+// Elements per task of the parallel fills (even, and a multiple of 4 * PHILOX_LANES)
+#define RNG_PARALLEL_CHUNK 16384
+
+static uint64_t global_seed = 0x853c49e6748fea9bull;
+static atomic_uint next_stream_id[RNG_SAMPLE + 1];
+
+// Function to set the seed every stream is derived from
+void rng_set_seed(uint64_t seed) {
+    global_seed = seed;
+}
+
+// Function to get the global seed
+uint64_t rng_get_seed(void) {
+    return global_seed;
+}
+
+// Function to hand out consecutive stream ids for a purpose (0, 1, 2, ...)
+// Ids follow call order, so sequential setup code gets the same ids on every run.
+uint32_t rng_next_stream_id(RngPurpose purpose) {
+    return atomic_fetch_add(&next_stream_id[purpose], 1);
+}
+
+// SplitMix64 finalizer, used to spread the user seed over the Philox key
+static uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Function to create the stream for (global seed, purpose, stream id)
+RngStream rng_stream(RngPurpose purpose, uint32_t stream_id) {
+    RngStream rng;
+    uint64_t key = mix64(global_seed);
+    rng.key[0] = (uint32_t)key;
+    rng.key[1] = (uint32_t)(key >> 32);
+    rng.stream[0] = stream_id;
+    rng.stream[1] = (uint32_t)purpose;
+    rng.position = 0;
+    rng.block_index = UINT64_MAX;
+    return rng;
+}
+
+// Function to move a stream to an absolute word position
+void rng_seek(RngStream* rng, uint64_t position) {
+    rng->position = position;
+}
+
+// Philox4x32-10 on PHILOX_LANES consecutive counters, written lane-major so the
+// 32x32->64 multiplies of every round vectorize across lanes
+static void philox_blocks(const RngStream* rng, uint64_t first_block, uint32_t out[][4]) {
+    uint32_t c0[PHILOX_LANES], c1[PHILOX_LANES], c2[PHILOX_LANES], c3[PHILOX_LANES];
+    for (int l = 0; l < PHILOX_LANES; ++l) {
+        uint64_t counter = first_block + l;
+        c0[l] = (uint32_t)counter;
+        c1[l] = (uint32_t)(counter >> 32);
+        c2[l] = rng->stream[0];
+        c3[l] = rng->stream[1];
+    }
+
+    uint32_t k0 = rng->key[0];
+    uint32_t k1 = rng->key[1];
+    for (int r = 0; r < PHILOX_ROUNDS; ++r) {
+        for (int l = 0; l < PHILOX_LANES; ++l) {
+            uint64_t p0 = (uint64_t)PHILOX_M0 * c0[l];
+            uint64_t p1 = (uint64_t)PHILOX_M1 * c2[l];
+            uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1[l] ^ k0;
+            uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3[l] ^ k1;
+            c1[l] = (uint32_t)p1;
+            c3[l] = (uint32_t)p0;
+            c0[l] = n0;
+            c2[l] = n2;
+        }
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    for (int l = 0; l < PHILOX_LANES; ++l) {
+        out[l][0] = c0[l];
+        out[l][1] = c1[l];
+        out[l][2] = c2[l];
+        out[l][3] = c3[l];
+    }
+}
+
+// Philox4x32-10 on a single counter, for the word-at-a-time path (same output as
+// lane 0 of philox_blocks)
+static void philox_block(const RngStream* rng, uint64_t block, uint32_t out[4]) {
+    uint32_t c0 = (uint32_t)block;
+    uint32_t c1 = (uint32_t)(block >> 32);
+    uint32_t c2 = rng->stream[0];
+    uint32_t c3 = rng->stream[1];
+    uint32_t k0 = rng->key[0];
+    uint32_t k1 = rng->key[1];
+    for (int r = 0; r < PHILOX_ROUNDS; ++r) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// Function to get the next 32-bit word of a stream
+uint32_t rng_next_u32(RngStream* rng) {
+    uint64_t block_index = rng->position >> 2;
+    if (block_index != rng->block_index) {
+        philox_block(rng, block_index, rng->block);
+        rng->block_index = block_index;
+    }
+    return rng->block[rng->position++ & 3];
+}
+
+// Function to convert a word into a float in [0, 1) with 24 bits of resolution
+static inline float u32_to_unit(uint32_t u) {
+    return (u >> 8) * (1.0f / 16777216.0f);
+}
+
+// Function to draw a float in [0, 1)
+float rng_uniform(RngStream* rng) {
+    return u32_to_unit(rng_next_u32(rng));
+}
+
+// Function to draw an integer in [0, n) (multiply-shift, no modulo bias beyond 2^-32)
+int rng_uniform_int(RngStream* rng, int n) {
+    return (int)(((uint64_t)rng_next_u32(rng) * (uint32_t)n) >> 32);
+}
+
+// Function to fill out[0..n) with consecutive words of a stream
+void rng_fill_u32(RngStream* rng, uint32_t* out, int n) {
+    int i = 0;
+    // Unaligned head, one word at a time
+    while (i < n && (rng->position & 3) != 0) {
+        out[i++] = rng_next_u32(rng);
+    }
+    uint32_t blocks[PHILOX_LANES][4];
+    while (n - i >= 4 * PHILOX_LANES) {
+        philox_blocks(rng, rng->position >> 2, blocks);
+        memcpy(out + i, blocks, sizeof(blocks));
+        rng->position += 4 * PHILOX_LANES;
+        i += 4 * PHILOX_LANES;
+    }
+    while (i < n) {
+        out[i++] = rng_next_u32(rng);
+    }
+}
+
+// Function to fill out[0..n) with uniform floats in [low, high)
+void rng_fill_uniform(RngStream* rng, float* out, int n, float low, float high) {
+    uint32_t words[256];
+    float range = high - low;
+    for (int i = 0; i < n; i += 256) {
+        int len = (n - i < 256) ? (n - i) : 256;
+        rng_fill_u32(rng, words, len);
+        for (int j = 0; j < len; ++j) {
+            out[i + j] = low + range * u32_to_unit(words[j]);
+        }
+    }
+}
+
+// Function to fill out[0..n) with normal floats (Box-Muller, two words per pair)
+// Element i always uses words 2 * (i / 2) and 2 * (i / 2) + 1 relative to the
+// starting position, so results do not depend on how a fill is split up.
+void rng_fill_normal(RngStream* rng, float* out, int n, float mean, float std) {
+    for (int i = 0; i < n; i += 2) {
+        uint32_t u[2];
+        rng_fill_u32(rng, u, 2);
+        float u1 = ((u[0] >> 8) + 1) * (1.0f / 16777216.0f); // (0, 1]
+        float u2 = u32_to_unit(u[1]);
+        float radius = sqrtf(-2.0f * logf(u1));
+        float theta = 6.28318530717958647f * u2;
+        out[i] = mean + std * radius * cosf(theta);
+        if (i + 1 < n) {
+            out[i + 1] = mean + std * radius * sinf(theta);
+        }
+    }
+}
+
+// Shared state of a parallel fill
+typedef struct {
+    const RngStream* rng;
+    float* out;
+    int n;
+    float a;
+    float b;
+    int normal;
+} RngFillJob;
+
+// Fill one chunk from its own copy of the stream, positioned at the chunk start
+static void rng_fill_chunk(int task, void* ctx) {
+    RngFillJob* job = (RngFillJob*)ctx;
+    int start = task * RNG_PARALLEL_CHUNK;
+    int len = (job->n - start < RNG_PARALLEL_CHUNK) ? (job->n - start) : RNG_PARALLEL_CHUNK;
+    RngStream local = *job->rng;
+    rng_seek(&local, job->rng->position + start);
+    if (job->normal) {
+        rng_fill_normal(&local, job->out + start, len, job->a, job->b);
+    } else {
+        rng_fill_uniform(&local, job->out + start, len, job->a, job->b);
+    }
+}
+
+// Function to run a fill over fixed-size chunks in parallel
+// Every element depends only on its position, so the result is the same as a
+// single sequential fill regardless of how chunks are scheduled.
+static void rng_fill_parallel(const RngStream* rng, float* out, int n, float a, float b, int normal) {
+    RngFillJob job = {rng, out, n, a, b, normal};
+    int n_chunks = (n + RNG_PARALLEL_CHUNK - 1) / RNG_PARALLEL_CHUNK;
+    if (n_chunks <= 1) {
+        if (n > 0) {
+            rng_fill_chunk(0, &job);
+        }
+        return;
+    }
+    parallel_for(n_chunks, rng_fill_chunk, &job);
+}
+
+// Function to fill a large buffer with uniform floats in parallel
+void rng_fill_uniform_parallel(const RngStream* rng, float* out, int n, float low, float high) {
+    rng_fill_parallel(rng, out, n, low, high, 0);
+}
+
+// Function to fill a large buffer with normal floats in parallel
+void rng_fill_normal_parallel(const RngStream* rng, float* out, int n, float mean, float std) {
+    rng_fill_parallel(rng, out, n, mean, std, 1);
+}
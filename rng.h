@@ -0,0 +1,43 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// What a random stream is used for; part of the stream key so that e.g. batch
+// sampling and weight init never share numbers even with equal stream ids
+typedef enum {
+    RNG_INIT = 1,   // Parameter initialization (stream id = parameter tensor id)
+    RNG_BATCH = 2,  // Training batch offsets (stream id = batch number)
+    RNG_SAMPLE = 3  // Token sampling (stream id = sequence id)
+} RngPurpose;
+
+// A Philox4x32-10 stream: the output is a pure function of (seed, purpose,
+// stream id, position), so any word can be produced independently of the others
+typedef struct {
+    uint32_t key[2];      // Derived from the global seed
+    uint32_t stream[2];   // (stream id, purpose)
+    uint64_t position;    // Index of the next 32-bit word
+    uint32_t block[4];    // Cached output block
+    uint64_t block_index; // Which block is cached (UINT64_MAX if none)
+} RngStream;
+
+// Function prototypes
+void rng_set_seed(uint64_t seed);
+uint64_t rng_get_seed(void);
+uint32_t rng_next_stream_id(RngPurpose purpose);
+RngStream rng_stream(RngPurpose purpose, uint32_t stream_id);
+void rng_seek(RngStream* rng, uint64_t position);
+uint32_t rng_next_u32(RngStream* rng);
+float rng_uniform(RngStream* rng);
+int rng_uniform_int(RngStream* rng, int n);
+
+// Bulk draws: fill out[0..n) with the words at positions [position, position + n)
+void rng_fill_u32(RngStream* rng, uint32_t* out, int n);
+void rng_fill_uniform(RngStream* rng, float* out, int n, float low, float high);
+void rng_fill_normal(RngStream* rng, float* out, int n, float mean, float std);
+
+// Parallel bulk draws over large buffers, bit-identical for any thread count
+void rng_fill_uniform_parallel(const RngStream* rng, float* out, int n, float low, float high);
+void rng_fill_normal_parallel(const RngStream* rng, float* out, int n, float mean, float std);
+
+#endif // RNG_H
@@ -0,0 +1,361 @@
+#include "server.h"
+#include "protocol.h"
+#include "threads.h"
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Connection waiting for a session, stamped so queueing delay can be reported
+typedef struct {
+    int fd;
+    double enqueued;
+} PendingConn;
+
+typedef struct {
+    BigramLanguageModel* model;
+    Vocabulary* vocab;
+
+    // Bounded FIFO of accepted connections
+    PendingConn queue[SERVER_QUEUE_CAPACITY];
+    int head, count;
+    int shutting_down;
+    int* active_fds; // Connection each session is serving, -1 when idle
+    int n_sessions;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    // Ring of per-request end-to-end latencies (ms) and totals
+    pthread_mutex_t stats_lock;
+    float latencies[SERVER_LATENCY_WINDOW];
+    float first_token[SERVER_LATENCY_WINDOW]; // Time until the client could see the first token
+    long n_requests;
+    long n_errors;
+    long n_tokens;
+    double compute_ms;
+    double started;
+} Server;
+
+typedef struct {
+    Server* server;
+    int index;
+} Session;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static int compare_floats(const void* a, const void* b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+// Token sink of one generation: streams tokens to the client when asked to and
+// cancels if the client disconnects or the server is stopping
+typedef struct {
+    int fd;
+    int stream;
+    float queue_ms;
+    double arrived;
+    double first_token_ms;
+} TokenSink;
+
+static int send_token(int token, const char* text, void* user_data) {
+    (void)token;
+    TokenSink* sink = (TokenSink*)user_data;
+    double now = now_seconds() * 1e3;
+    if (sink->first_token_ms < 0.0) {
+        sink->first_token_ms = now - sink->arrived + sink->queue_ms;
+    }
+    if (sink->stream) {
+        GenResponse partial = {STATUS_TOKEN, sink->queue_ms, (float)(now - sink->arrived), 1, (char*)text};
+        if (send_response(sink->fd, &partial) != 0) {
+            return 1;
+        }
+    }
+    return stop_requested;
+}
+
+// Function to sort a copy of the newest n entries of a latency ring and read p50/p99
+static void ring_percentiles(const float* ring, long n, float* p50, float* p99) {
+    *p50 = *p99 = 0.0f;
+    if (n == 0) {
+        return;
+    }
+    float* sorted = (float*)malloc(n * sizeof(float));
+    memcpy(sorted, ring, n * sizeof(float));
+    qsort(sorted, n, sizeof(float), compare_floats);
+    *p50 = sorted[(n - 1) / 2];
+    *p99 = sorted[(long)((n - 1) * 0.99)];
+    free(sorted);
+}
+
+// Function to record one finished request
+static void record_request(Server* server, float latency_ms, float first_token_ms, float compute_ms, int n_tokens, int ok) {
+    pthread_mutex_lock(&server->stats_lock);
+    server->latencies[server->n_requests % SERVER_LATENCY_WINDOW] = latency_ms;
+    server->first_token[server->n_requests % SERVER_LATENCY_WINDOW] = first_token_ms;
+    server->n_requests++;
+    server->n_errors += !ok;
+    server->n_tokens += n_tokens;
+    server->compute_ms += compute_ms;
+    pthread_mutex_unlock(&server->stats_lock);
+}
+
+// Function to format the latency summary returned for MSG_STATS
+static char* format_stats(Server* server) {
+    float p50, p99, ttft_p50, ttft_p99;
+    pthread_mutex_lock(&server->stats_lock);
+    long n = server->n_requests < SERVER_LATENCY_WINDOW ? server->n_requests : SERVER_LATENCY_WINDOW;
+    ring_percentiles(server->latencies, n, &p50, &p99);
+    ring_percentiles(server->first_token, n, &ttft_p50, &ttft_p99);
+    long n_requests = server->n_requests, n_errors = server->n_errors, n_tokens = server->n_tokens;
+    double compute_ms = server->compute_ms;
+    pthread_mutex_unlock(&server->stats_lock);
+
+    double uptime_s = (now_seconds() * 1e3 - server->started) / 1e3;
+    char* text = (char*)malloc(512);
+    snprintf(text, 512,
+             "requests: %ld (%ld errors), tokens: %ld, uptime: %.1f s\n"
+             "latency p50: %.2f ms, p99: %.2f ms (last %ld requests)\n"
+             "first token p50: %.2f ms, p99: %.2f ms\n"
+             "throughput: %.1f tokens/s of compute\n",
+             n_requests, n_errors, n_tokens, uptime_s, p50, p99, n, ttft_p50, ttft_p99,
+             compute_ms > 0 ? n_tokens / (compute_ms / 1e3) : 0.0);
+    return text;
+}
+
+// Function to check that every prompt character is in the vocabulary
+static int prompt_in_vocab(const char* prompt, const Vocabulary* vocab) {
+    for (const char* p = prompt; *p; ++p) {
+        int found = 0;
+        for (int i = 0; i < vocab->vocab_size; ++i) {
+            if (vocab->chars[i][0] == *p) {
+                found = 1;
+                break;
+            }
+        }
+        if (!found) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to answer a single request
+static void handle_request(Server* server, int fd, const GenRequest* request, double arrived, double queue_ms) {
+    GenResponse response = {STATUS_OK, queue_ms, 0.0f, 0, NULL};
+    char* owned = NULL;
+
+    if (request->type == MSG_STATS) {
+        owned = format_stats(server);
+        response.text = owned;
+        send_response(fd, &response);
+        free(owned);
+        return;
+    }
+
+    TokenSink sink = {fd, request->type == MSG_GENERATE_STREAM, (float)queue_ms, arrived, -1.0};
+    if (request->type != MSG_GENERATE && request->type != MSG_GENERATE_STREAM) {
+        response.status = STATUS_ERROR;
+        response.text = "unknown request type";
+    } else if (request->prompt[0] == '\0') {
+        response.status = STATUS_ERROR;
+        response.text = "empty prompt";
+    } else if (!prompt_in_vocab(request->prompt, server->vocab)) {
+        response.status = STATUS_ERROR;
+        response.text = "prompt contains characters outside the vocabulary";
+    } else if (request->max_new_tokens < 1 || request->max_new_tokens > SERVER_MAX_NEW_TOKENS) {
+        response.status = STATUS_ERROR;
+        response.text = "max_new_tokens out of range";
+    } else if (strlen(request->prompt) + request->max_new_tokens + RESPONSE_HEADER_BYTES > MAX_FRAME_BYTES) {
+        // The final response carries the prompt plus one character per token
+        response.status = STATUS_ERROR;
+        response.text = "response would exceed the frame size limit";
+    } else if (!isfinite(request->temperature)) {
+        response.status = STATUS_ERROR;
+        response.text = "temperature must be finite";
+    } else {
+        SamplingParams params = {request->temperature, (int)request->top_k, request->seed, request->has_seed != 0};
+        GenerationStats gen_stats;
+        owned = generate_stream(server->model, server->vocab, request->prompt, (int)request->max_new_tokens,
+                                &params, send_token, &sink, &gen_stats);
+        response.compute_ms = gen_stats.total_seconds * 1e3;
+        response.n_tokens = gen_stats.n_tokens;
+        response.text = owned ? owned : "generation failed";
+        if (!owned) {
+            response.status = STATUS_ERROR;
+        }
+    }
+
+    send_response(fd, &response);
+    float latency_ms = now_seconds() * 1e3 - arrived + queue_ms;
+    // Without streaming the client sees nothing before the final response
+    float first_token_ms = sink.stream && sink.first_token_ms >= 0.0 ? sink.first_token_ms : latency_ms;
+    record_request(server, latency_ms, first_token_ms, response.compute_ms, response.n_tokens,
+                   response.status == STATUS_OK);
+    free(owned);
+}
+
+// Session worker: serves one connection at a time until the client hangs up
+static void* session_main(void* arg) {
+    Session* session = (Session*)arg;
+    Server* server = session->server;
+    // Sessions run side by side; each parallelizes only over its own share of the cores
+    int budget = get_num_threads() / server->n_sessions;
+    set_thread_budget(budget > 0 ? budget : 1);
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (server->count == 0 && !server->shutting_down) {
+            pthread_cond_wait(&server->not_empty, &server->lock);
+        }
+        if (server->count == 0) {
+            pthread_mutex_unlock(&server->lock);
+            return NULL;
+        }
+        PendingConn conn = server->queue[server->head];
+        server->head = (server->head + 1) % SERVER_QUEUE_CAPACITY;
+        server->count--;
+        server->active_fds[session->index] = conn.fd;
+        pthread_cond_signal(&server->not_full);
+        pthread_mutex_unlock(&server->lock);
+
+        // Only the first request on a connection waited in the accept queue
+        double queue_ms = now_seconds() * 1e3 - conn.enqueued;
+        GenRequest request;
+        while (!stop_requested && recv_request(conn.fd, &request) == 0) {
+            handle_request(server, conn.fd, &request, now_seconds() * 1e3, queue_ms);
+            free(request.prompt);
+            queue_ms = 0.0;
+        }
+        pthread_mutex_lock(&server->lock);
+        server->active_fds[session->index] = -1;
+        pthread_mutex_unlock(&server->lock);
+        close(conn.fd);
+    }
+}
+
+// Function to serve generation requests on a Unix domain socket until SIGINT/SIGTERM.
+// The model and vocabulary stay loaded for the lifetime of the process; up to
+// n_sessions connections are served concurrently, further ones wait in a queue.
+int run_server(BigramLanguageModel* model, Vocabulary* vocab, const char* socket_path, int n_sessions) {
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    if (n_sessions < 1) {
+        n_sessions = 1;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("Failed to create socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, SERVER_QUEUE_CAPACITY) != 0) {
+        perror("Failed to bind socket");
+        close(listen_fd);
+        return -1;
+    }
+
+    // No SA_RESTART so a stop signal interrupts accept()
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    Server* server = (Server*)calloc(1, sizeof(Server));
+    server->model = model;
+    server->vocab = vocab;
+    server->started = now_seconds() * 1e3;
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->not_empty, NULL);
+    pthread_cond_init(&server->not_full, NULL);
+    pthread_mutex_init(&server->stats_lock, NULL);
+
+    server->n_sessions = n_sessions;
+    server->active_fds = (int*)malloc(n_sessions * sizeof(int));
+    pthread_t* threads = (pthread_t*)malloc(n_sessions * sizeof(pthread_t));
+    Session* sessions = (Session*)malloc(n_sessions * sizeof(Session));
+    for (int i = 0; i < n_sessions; ++i) {
+        server->active_fds[i] = -1;
+        sessions[i].server = server;
+        sessions[i].index = i;
+        pthread_create(&threads[i], NULL, session_main, &sessions[i]);
+    }
+    fprintf(stderr, "Serving on %s with %d sessions\n", socket_path, n_sessions);
+
+    while (!stop_requested) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        pthread_mutex_lock(&server->lock);
+        while (server->count == SERVER_QUEUE_CAPACITY && !stop_requested) {
+            pthread_cond_wait(&server->not_full, &server->lock);
+        }
+        int tail = (server->head + server->count) % SERVER_QUEUE_CAPACITY;
+        server->queue[tail].fd = fd;
+        server->queue[tail].enqueued = now_seconds() * 1e3;
+        server->count++;
+        pthread_cond_signal(&server->not_empty);
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    // Stop accepting, wake sessions blocked on idle clients, then clean up.
+    // Generations in flight are cancelled and answered with the text so far.
+    close(listen_fd);
+    unlink(socket_path);
+    pthread_mutex_lock(&server->lock);
+    server->shutting_down = 1;
+    for (int i = 0; i < n_sessions; ++i) {
+        if (server->active_fds[i] >= 0) {
+            shutdown(server->active_fds[i], SHUT_RD);
+        }
+    }
+    while (server->count > 0) {
+        close(server->queue[server->head].fd);
+        server->head = (server->head + 1) % SERVER_QUEUE_CAPACITY;
+        server->count--;
+    }
+    pthread_cond_broadcast(&server->not_empty);
+    pthread_mutex_unlock(&server->lock);
+    for (int i = 0; i < n_sessions; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    char* summary = format_stats(server);
+    fprintf(stderr, "Server stopped.\n%s", summary);
+    free(summary);
+
+    free(threads);
+    free(sessions);
+    free(server->active_fds);
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->not_empty);
+    pthread_cond_destroy(&server->not_full);
+    pthread_mutex_destroy(&server->stats_lock);
+    free(server);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "model.h"
+#include "data.h"
+
+// Pending connections the accept loop may queue before it blocks
+#define SERVER_QUEUE_CAPACITY 64
+// Most recent requests kept for the latency percentiles
+#define SERVER_LATENCY_WINDOW 4096
+// Largest max_new_tokens a request may ask for
+#define SERVER_MAX_NEW_TOKENS 16384
+
+// Function prototypes
+int run_server(BigramLanguageModel* model, Vocabulary* vocab, const char* socket_path, int n_sessions);
+
+#endif // SERVER_H
@@ -0,0 +1,232 @@
+#include "speculative.h"
+#include "vmath.h"
+#include "threads.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Function to extend a model's KV cache with seq[cache->len, len) and keep the
+// probabilities of the last n_rows positions
+// Only positions missing from the cache are computed; n_rows must not exceed them.
+static int forward_probs(BigramLanguageModel* model, KVCache* cache, const int* seq, int len, int n_rows,
+                         Tensor* hidden, Tensor* logits, float* probs) {
+    int past_len = cache->len;
+    if (model_forward_cached_hidden_into(model, seq + past_len, len - past_len, cache, hidden) != 0 ||
+        model_logits_last_into(model, hidden, n_rows, logits) != 0) {
+        return 0;
+    }
+    int vocab_size = logits->shape[1];
+    for (int r = 0; r < n_rows; ++r) {
+        float* row_probs = probs + (size_t)r * vocab_size;
+        memcpy(row_probs, logits->data + (size_t)r * vocab_size, vocab_size * sizeof(float));
+        row_softmax(row_probs, vocab_size);
+    }
+    return 1;
+}
+
+// Function to sample from the residual distribution norm(max(0, p - q))
+static int sample_residual(const float* p, const float* q, float* scratch, int n, RngStream* rng) {
+    float total = 0.0f;
+    for (int j = 0; j < n; ++j) {
+        float d = p[j] - q[j];
+        scratch[j] = (d > 0.0f) ? d : 0.0f;
+        total += scratch[j];
+    }
+    if (total <= 0.0f) {
+        // p == q up to rounding, so the residual is p itself
+        return sample_from_distribution(p, n, rng);
+    }
+    for (int j = 0; j < n; ++j) {
+        scratch[j] /= total;
+    }
+    return sample_from_distribution(scratch, n, rng);
+}
+
+// Function to generate text with speculative decoding
+// The draft model proposes k tokens autoregressively, then the target model scores
+// [context + k] in one forward pass. Draft token x_i is accepted with probability
+// min(1, p_i(x_i) / q_i(x_i)); on the first rejection a replacement is drawn from
+// norm(max(0, p_i - q_i)), and if all k are accepted a bonus token is drawn from
+// p_k. This keeps the output distributed exactly as sampling from the target.
+// k grows while whole drafts are accepted and shrinks when most are rejected.
+// Both models keep a KV cache of the accepted sequence, so each draft token and each
+// verification only compute their new positions; rejected positions are truncated.
+// Verification needs every position inside one context window; once drafts no longer
+// fit, the rest is sampled from the target one token at a time over its last block_size tokens.
+char* generate_speculative(BigramLanguageModel* model, BigramLanguageModel* draft, Vocabulary* vocab,
+                           const char* start_text, int max_new_tokens, int max_draft_len,
+                           SpeculativeStats* stats) {
+    int vocab_size = model->token_embedding_table->shape[0];
+    if (draft->token_embedding_table->shape[0] != vocab_size) {
+        fprintf(stderr, "Draft and target models must share the same vocabulary.\n");
+        return NULL;
+    }
+
+    // Verification needs at least one position of real context before the drafts
+    int block_size = model->position_embedding_table->shape[0];
+    int draft_block_size = draft->position_embedding_table->shape[0];
+    if (max_draft_len > block_size - 1) {
+        max_draft_len = block_size - 1;
+    }
+    if (max_draft_len < 1) {
+        max_draft_len = 1;
+    }
+
+    SpeculativeStats local_stats;
+    if (!stats) {
+        stats = &local_stats;
+    }
+    memset(stats, 0, sizeof(SpeculativeStats));
+    double start_time = now_seconds();
+    RngStream rng = rng_stream(RNG_SAMPLE, rng_next_stream_id(RNG_SAMPLE));
+
+    int current_len = strlen(start_text);
+    int* encoded_start = encode(start_text, vocab);
+    int capacity = current_len + max_new_tokens + max_draft_len + 1;
+    int* sequence = (int*)malloc(capacity * sizeof(int));
+    memcpy(sequence, encoded_start, current_len * sizeof(int));
+    free(encoded_start);
+    int prompt_len = current_len;
+    int end_len = current_len + max_new_tokens;
+
+    float* q = (float*)malloc((size_t)max_draft_len * vocab_size * sizeof(float));
+    float* p = (float*)malloc((size_t)(max_draft_len + 1) * vocab_size * sizeof(float));
+    float* scratch = (float*)malloc(vocab_size * sizeof(float));
+    KVCache* target_cache = create_model_kv_cache(model);
+    KVCache* draft_cache = create_model_kv_cache(draft);
+    int hidden_shape[] = {1, model->token_embedding_table->shape[1]};
+    int logits_shape[] = {1, vocab_size};
+    Tensor* hidden = create_tensor(hidden_shape, 2);
+    Tensor* logits = create_tensor(logits_shape, 2);
+
+    // The target verifies positions [0, current_len + k_step) and the draft
+    // consumes [0, current_len + k_step - 1), all within their context windows
+    int window_end = (draft_block_size + 1 < block_size) ? draft_block_size + 1 : block_size;
+
+    int k = (max_draft_len < 4) ? max_draft_len : 4;
+    int ok = current_len > 0;
+    while (ok && current_len < end_len) {
+        int remaining = end_len - current_len;
+        int k_step = (k < remaining) ? k : remaining;
+        if (k_step > window_end - current_len) {
+            k_step = window_end - current_len;
+        }
+        if (k_step < 1) {
+            break;
+        }
+
+        // Draft phase: propose k_step tokens from the small model
+        double t0 = now_seconds();
+        int n_drafted = 0;
+        while (n_drafted < k_step) {
+            float* q_i = q + (size_t)n_drafted * vocab_size;
+            if (!forward_probs(draft, draft_cache, sequence, current_len + n_drafted, 1, hidden, logits, q_i)) {
+                break;
+            }
+            sequence[current_len + n_drafted] = sample_from_distribution(q_i, vocab_size, &rng);
+            stats->draft_forwards++;
+            n_drafted++;
+        }
+        double t1 = now_seconds();
+        stats->draft_seconds += t1 - t0;
+
+        // Verification phase: one target pass over [context + k_step]
+        if (n_drafted < k_step ||
+            !forward_probs(model, target_cache, sequence, current_len + k_step, k_step + 1, hidden, logits, p)) {
+            ok = 0;
+            break;
+        }
+        stats->target_seconds += now_seconds() - t1;
+        stats->target_forwards++;
+        stats->drafted += k_step;
+
+        int n_accepted = 0;
+        int next_token = -1;
+        for (int i = 0; i < k_step; ++i) {
+            int x = sequence[current_len + i];
+            float p_x = p[(size_t)i * vocab_size + x];
+            float q_x = q[(size_t)i * vocab_size + x];
+            // Strict, so a token the target gives zero probability is never accepted (u can be 0)
+            if (rng_uniform(&rng) * q_x < p_x) {
+                n_accepted++;
+                continue;
+            }
+            next_token = sample_residual(p + (size_t)i * vocab_size, q + (size_t)i * vocab_size,
+                                         scratch, vocab_size, &rng);
+            break;
+        }
+        if (next_token < 0) {
+            next_token = sample_from_distribution(p + (size_t)k_step * vocab_size, vocab_size, &rng);
+        }
+
+        stats->accepted += n_accepted;
+        current_len += n_accepted;
+        if (current_len < end_len) {
+            sequence[current_len++] = next_token;
+        }
+
+        // Keep only the accepted prefix cached; the newest token is fed on the next pass
+        truncate_kv_cache(target_cache, current_len - 1);
+        truncate_kv_cache(draft_cache, current_len - 1);
+
+        // Adapt the draft length to the observed acceptance
+        if (n_accepted == k_step && k < max_draft_len) {
+            k++;
+        } else if (2 * n_accepted < k_step && k > 1) {
+            k--;
+        }
+    }
+
+    // Plain decoding from the target past the verifiable window
+    while (ok && current_len < end_len) {
+        double t0 = now_seconds();
+        const int* window = sequence;
+        int window_len = current_len;
+        if (current_len > block_size) {
+            reset_kv_cache(target_cache);
+            window = sequence + current_len - block_size;
+            window_len = block_size;
+        }
+        if (!forward_probs(model, target_cache, window, window_len, 1, hidden, logits, p)) {
+            break;
+        }
+        sequence[current_len++] = sample_from_distribution(p, vocab_size, &rng);
+        stats->target_seconds += now_seconds() - t0;
+        stats->target_forwards++;
+    }
+
+    stats->final_draft_len = k;
+    stats->generated = current_len - prompt_len;
+    stats->total_seconds = now_seconds() - start_time;
+
+    char* decoded_text = decode(sequence, current_len, vocab);
+    free(sequence);
+    free(q);
+    free(p);
+    free(scratch);
+    free_tensor(hidden);
+    free_tensor(logits);
+    free_kv_cache(target_cache);
+    free_kv_cache(draft_cache);
+    return decoded_text;
+}
+
+// Function to print acceptance and estimated speedup of a speculative generation
+// The baseline is one target forward per generated token at the measured cost of
+// a verification pass, so the estimate is conservative for short drafts.
+void print_speculative_stats(const SpeculativeStats* stats) {
+    double acceptance = stats->drafted ? (double)stats->accepted / stats->drafted : 0.0;
+    double tokens_per_pass = stats->target_forwards ? (double)stats->generated / stats->target_forwards : 0.0;
+    double target_pass = stats->target_forwards ? stats->target_seconds / stats->target_forwards : 0.0;
+    double baseline = target_pass * stats->generated;
+    double speedup = (stats->total_seconds > 0.0) ? baseline / stats->total_seconds : 0.0;
+
+    printf("Speculative decoding: %ld tokens, %ld target passes, %.2f tokens/pass\n",
+           stats->generated, stats->target_forwards, tokens_per_pass);
+    printf("  acceptance %.1f%% (%ld/%ld drafted), final draft length %d\n",
+           100.0 * acceptance, stats->accepted, stats->drafted, stats->final_draft_len);
+    printf("  %.2f ms/token (draft %.2fs, target %.2fs), estimated speedup %.2fx\n",
+           stats->generated ? 1000.0 * stats->total_seconds / stats->generated : 0.0,
+           stats->draft_seconds, stats->target_seconds, speedup);
+}
@@ -0,0 +1,25 @@
+#ifndef SPECULATIVE_H
+#define SPECULATIVE_H
+
+#include "model.h"
+
+// Counters collected during speculative decoding
+typedef struct {
+    long generated;        // Tokens appended to the sequence
+    long drafted;          // Tokens proposed by the draft model
+    long accepted;         // Draft tokens accepted by the target model
+    long target_forwards;  // Verification passes of the target model
+    long draft_forwards;   // Forward passes of the draft model
+    double target_seconds; // Time spent in target forwards
+    double draft_seconds;  // Time spent in draft forwards
+    double total_seconds;  // Wall-clock time of the whole generation
+    int final_draft_len;   // Draft length k at the end of generation
+} SpeculativeStats;
+
+// Function prototypes
+char* generate_speculative(BigramLanguageModel* model, BigramLanguageModel* draft, Vocabulary* vocab,
+                           const char* start_text, int max_new_tokens, int max_draft_len,
+                           SpeculativeStats* stats);
+void print_speculative_stats(const SpeculativeStats* stats);
+
+#endif // SPECULATIVE_H
@@ -0,0 +1,53 @@
+#include "spsc_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Function to create a queue holding at least capacity items
+SpscQueue* create_spsc_queue(int capacity) {
+    if (capacity < 1) {
+        fprintf(stderr, "SPSC queue capacity must be positive\n");
+        return NULL;
+    }
+    size_t size = 1;
+    while (size < (size_t)capacity) {
+        size <<= 1;
+    }
+    SpscQueue* queue = (SpscQueue*)aligned_alloc(64, (sizeof(SpscQueue) + 63) & ~(size_t)63);
+    queue->slots = (void**)calloc(size, sizeof(void*));
+    queue->mask = size - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return queue;
+}
+
+// Function to free a queue (items still queued are not freed)
+void free_spsc_queue(SpscQueue* queue) {
+    free(queue->slots);
+    free(queue);
+}
+
+// Function to push an item, returning 0 on success and -1 if the queue is full
+// Producer thread only.
+int spsc_try_push(SpscQueue* queue, void* item) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head > queue->mask) {
+        return -1;
+    }
+    queue->slots[tail & queue->mask] = item;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+// Function to pop an item, returning 0 on success and -1 if the queue is empty
+// Consumer thread only.
+int spsc_try_pop(SpscQueue* queue, void** item) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head == tail) {
+        return -1;
+    }
+    *item = queue->slots[head & queue->mask];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Lock-free bounded queue of pointers between exactly one producer and one consumer
+// thread. NULL is a valid item. head and tail sit on separate cache lines so the
+// two sides do not false-share.
+typedef struct {
+    void** slots;
+    size_t mask;                      // capacity - 1, capacity is a power of two
+    _Alignas(64) atomic_size_t head;  // Next slot to pop, written by the consumer
+    _Alignas(64) atomic_size_t tail;  // Next slot to push, written by the producer
+} SpscQueue;
+
+// Function prototypes
+SpscQueue* create_spsc_queue(int capacity);
+void free_spsc_queue(SpscQueue* queue);
+int spsc_try_push(SpscQueue* queue, void* item);
+int spsc_try_pop(SpscQueue* queue, void** item);
+
+#endif // SPSC_QUEUE_H
@@ -1,4 +1,9 @@
 #include "tensor.h"
+#include "vmath.h"
+#include "rng.h"
+#include "kernels.h"
+#include "gemm_tune.h"
+#include "threads.h"
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
@@ -16,6 +21,7 @@ Tensor* create_tensor(const int* shape, int n_dims) {
     }
 
     tensor->data = (float*)calloc(tensor->size, sizeof(float));
+    tensor->capacity = tensor->size;
     return tensor;
 }
 
@@ -26,6 +32,47 @@ void free_tensor(Tensor* tensor) {
     free(tensor);
 }
 
+// Function to give a tensor a new shape, keeping its storage when it is large enough
+// A NULL tensor is created. Contents are unspecified after a resize that changes
+// the size; buffers reused across steps are expected to be overwritten.
+Tensor* resize_tensor(Tensor* tensor, const int* shape, int n_dims) {
+    if (!tensor) {
+        return create_tensor(shape, n_dims);
+    }
+    if (n_dims != tensor->n_dims) {
+        tensor->shape = (int*)realloc(tensor->shape, n_dims * sizeof(int));
+        tensor->n_dims = n_dims;
+    }
+    int size = 1;
+    for (int i = 0; i < n_dims; ++i) {
+        tensor->shape[i] = shape[i];
+        size *= shape[i];
+    }
+    if (size > tensor->capacity) {
+        free(tensor->data);
+        tensor->data = (float*)calloc(size, sizeof(float));
+        tensor->capacity = size;
+    }
+    tensor->size = size;
+    return tensor;
+}
+
+// Function to wrap existing storage in a borrowed tensor
+// data and shape stay owned by the caller and must outlive the view; never free it.
+// Passing it as an _into destination of its own shape writes straight into data.
+Tensor tensor_view(float* data, int* shape, int n_dims) {
+    Tensor view;
+    view.data = data;
+    view.shape = shape;
+    view.n_dims = n_dims;
+    view.size = 1;
+    for (int i = 0; i < n_dims; ++i) {
+        view.size *= shape[i];
+    }
+    view.capacity = view.size;
+    return view;
+}
+
 // Helper function to get the index in the flat data array
 int get_data_index(const Tensor* tensor, const int* indices) {
     int index = 0;
@@ -72,28 +119,383 @@ void print_tensor(const Tensor* tensor) {
     }
 }
 
-// Function to generate a random float between 0 and 1
+// Function to generate a random float in [0, 1)
+// Draws from a per-thread sampling stream; code that needs reproducible draws
+// should own an RngStream instead.
 float rand_float() {
-    return (float)rand() / (float)RAND_MAX;
+    static __thread RngStream rng;
+    static __thread int initialized = 0;
+    if (!initialized) {
+        rng = rng_stream(RNG_SAMPLE, rng_next_stream_id(RNG_SAMPLE));
+        initialized = 1;
+    }
+    return rng_uniform(&rng);
+}
+
+// Function to pack a [K, N] matrix with row stride rs and column stride cs into GEMM panels
+// Columns are grouped into panels of GEMM_NR; each panel stores its K rows contiguously
+// (K x GEMM_NR floats), with the last panel zero-padded. A transposed operand is
+// packed directly by swapping the strides.
+static void pack_panels(float* panels, const float* b, int k, int n, long rs, long cs) {
+    int n_panels = (n + GEMM_NR - 1) / GEMM_NR;
+    for (int p = 0; p < n_panels; ++p) {
+        int j0 = p * GEMM_NR;
+        int nr = (n - j0 < GEMM_NR) ? (n - j0) : GEMM_NR;
+        float* panel = panels + (size_t)p * k * GEMM_NR;
+        for (int kk = 0; kk < k; ++kk) {
+            float* dst = panel + (size_t)kk * GEMM_NR;
+            const float* src = b + kk * rs + j0 * cs;
+            if (cs == 1) {
+                memcpy(dst, src, nr * sizeof(float));
+            } else {
+                for (int j = 0; j < nr; ++j) {
+                    dst[j] = src[j * cs];
+                }
+            }
+            for (int j = nr; j < GEMM_NR; ++j) {
+                dst[j] = 0.0f;
+            }
+        }
+    }
+}
+
+// Function to pack a [K, N] row-major matrix into the panel layout of the GEMM kernel
+PackedMatrix* pack_matrix(const float* b, int k, int n) {
+    PackedMatrix* packed = (PackedMatrix*)malloc(sizeof(PackedMatrix));
+    packed->k = k;
+    packed->n = n;
+    int n_panels = (n + GEMM_NR - 1) / GEMM_NR;
+    packed->data = (float*)malloc((size_t)n_panels * k * GEMM_NR * sizeof(float));
+    pack_panels(packed->data, b, k, n, n, 1);
+    return packed;
+}
+
+// Function to free a packed matrix
+void free_packed_matrix(PackedMatrix* packed) {
+    free(packed->data);
+    free(packed);
+}
+
+// Function to compute C[m, n] = A[m, k] * B where B is already packed
+// The blocking comes from the per-host tuning cache, or a heuristic (see gemm_tune.c).
+void gemm_packed(const float* a, int m, const PackedMatrix* b, float* c) {
+    GemmConfig cfg = gemm_config_for(m, b->k, b->n);
+    gemm_packed_config(a, m, b, c, &cfg);
 }
 
-// Function for matrix multiplication (for 2D tensors)
+// Function to magnitude-prune B[k, n] to 2:4 sparsity and compress it
+// In each column, the two largest-magnitude entries of every group of four rows
+// are kept (the earlier one on ties) and the other two are zeroed in b itself,
+// so dense code using b computes the same function as gemm_sparse.
+SparseMatrix* compress_2_4(float* b, int k, int n) {
+    if (k % 8 != 0) {
+        fprintf(stderr, "2:4 compression needs a multiple of 8 rows, got %d.\n", k);
+        return NULL;
+    }
+    int n_panels = (n + GEMM_NR - 1) / GEMM_NR;
+    SparseMatrix* sparse = (SparseMatrix*)malloc(sizeof(SparseMatrix));
+    sparse->k = k;
+    sparse->n = n;
+    sparse->values = (float*)calloc((size_t)n_panels * (k / 2) * GEMM_NR, sizeof(float));
+    sparse->indices = (uint8_t*)calloc((size_t)n_panels * (k / 8) * GEMM_NR, 1);
+
+    for (int col = 0; col < n; ++col) {
+        // Column col is lane col % GEMM_NR of its panel; its entries are GEMM_NR apart
+        int p = col / GEMM_NR;
+        float* values = sparse->values + (size_t)p * (k / 2) * GEMM_NR + col % GEMM_NR;
+        uint8_t* indices = sparse->indices + (size_t)p * (k / 8) * GEMM_NR + col % GEMM_NR;
+        for (int g = 0; g < k / 4; ++g) {
+            float* group = b + (size_t)4 * g * n + col;
+            int first = 0;
+            int second = -1;
+            for (int i = 1; i < 4; ++i) {
+                float mag = fabsf(group[(size_t)i * n]);
+                if (mag > fabsf(group[(size_t)first * n])) {
+                    second = first;
+                    first = i;
+                } else if (second < 0 || mag > fabsf(group[(size_t)second * n])) {
+                    second = i;
+                }
+            }
+            int lo = first < second ? first : second;
+            int hi = first < second ? second : first;
+            values[(size_t)(2 * g) * GEMM_NR] = group[(size_t)lo * n];
+            values[(size_t)(2 * g + 1) * GEMM_NR] = group[(size_t)hi * n];
+            indices[(size_t)(g / 2) * GEMM_NR] |= (uint8_t)((lo | (hi << 2)) << (4 * (g % 2)));
+            for (int i = 0; i < 4; ++i) {
+                if (i != lo && i != hi) {
+                    group[(size_t)i * n] = 0.0f;
+                }
+            }
+        }
+    }
+    return sparse;
+}
+
+// Function to free a 2:4 sparse matrix
+void free_sparse_matrix(SparseMatrix* sparse) {
+    free(sparse->values);
+    free(sparse->indices);
+    free(sparse);
+}
+
+// Function to get the bytes a 2:4 sparse matrix holds (values plus indices)
+size_t sparse_matrix_bytes(const SparseMatrix* sparse) {
+    size_t columns = (size_t)(sparse->n + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+    return columns * (sparse->k / 2) * sizeof(float) + columns * (sparse->k / 8);
+}
+
+// Function to compute C[m, n] = A[m, k] * B where B is 2:4 sparse
+// Threads come from the tuning entry of the dense shape, as for gemm_packed.
+void gemm_sparse(const float* a, int m, const SparseMatrix* b, float* c) {
+    GemmConfig cfg = gemm_config_for(m, b->k, b->n);
+    gemm_sparse_config(a, m, b, c, &cfg);
+}
+
+// Function for matrix multiplication with a pre-packed right-hand side, into out
+// a is [..., K]; every leading index is one row, so out is [..., N] without reshaping.
+int matmul_packed_into(Tensor* out, const Tensor* a, const PackedMatrix* b) {
+    if (a->n_dims < 1 || a->shape[a->n_dims - 1] != b->k) {
+        fprintf(stderr, "Matrix dimensions are not compatible for multiplication.\n");
+        return -1;
+    }
+    int new_shape[a->n_dims];
+    memcpy(new_shape, a->shape, a->n_dims * sizeof(int));
+    new_shape[a->n_dims - 1] = b->n;
+    resize_tensor(out, new_shape, a->n_dims);
+    gemm_packed(a->data, a->size / b->k, b, out->data);
+    return 0;
+}
+
+// Function for matrix multiplication with a 2:4 sparse right-hand side, into out
+// a is [..., K] and out becomes [..., N], as in matmul_packed_into.
+int matmul_sparse_into(Tensor* out, const Tensor* a, const SparseMatrix* b) {
+    if (a->n_dims < 1 || a->shape[a->n_dims - 1] != b->k) {
+        fprintf(stderr, "Matrix dimensions are not compatible for multiplication.\n");
+        return -1;
+    }
+    int new_shape[a->n_dims];
+    memcpy(new_shape, a->shape, a->n_dims * sizeof(int));
+    new_shape[a->n_dims - 1] = b->n;
+    resize_tensor(out, new_shape, a->n_dims);
+    gemm_sparse(a->data, a->size / b->k, b, out->data);
+    return 0;
+}
+
+// Function for matrix multiplication with a pre-packed right-hand side
+Tensor* matmul_packed(const Tensor* a, const PackedMatrix* b) {
+    if (a->n_dims < 1) {
+        fprintf(stderr, "Matrix dimensions are not compatible for multiplication.\n");
+        return NULL;
+    }
+    int out_shape[a->n_dims];
+    memcpy(out_shape, a->shape, a->n_dims * sizeof(int));
+    out_shape[a->n_dims - 1] = b->n;
+    Tensor* result = create_tensor(out_shape, a->n_dims);
+    if (matmul_packed_into(result, a, b) != 0) {
+        free_tensor(result);
+        return NULL;
+    }
+    return result;
+}
+
+// Per-thread buffer for packing batched GEMM operands
+static ThreadBuffer bmm_pack_buffer = THREAD_BUFFER_INIT;
+
+// Function to get the shape of a[..., M, K] * op(b), broadcasting the batch dimensions
+// op(b) is b[..., K, N], or the transpose of b[..., N, K] when transpose_b is set.
+// out_shape needs room for the larger n_dims of a and b; returns its length, or -1.
+static int bmm_output_shape(const Tensor* a, const Tensor* b, int transpose_b, int* out_shape) {
+    if (a->n_dims < 2 || b->n_dims < 2) {
+        fprintf(stderr, "Batched matrix multiplication needs at least 2D tensors.\n");
+        return -1;
+    }
+    int K = a->shape[a->n_dims - 1];
+    int b_rows = b->shape[b->n_dims - 2];
+    int b_cols = b->shape[b->n_dims - 1];
+    if ((transpose_b ? b_cols : b_rows) != K) {
+        fprintf(stderr, "Matrix dimensions are not compatible for multiplication.\n");
+        return -1;
+    }
+    int a_batch_dims = a->n_dims - 2;
+    int b_batch_dims = b->n_dims - 2;
+    int n_batch_dims = a_batch_dims > b_batch_dims ? a_batch_dims : b_batch_dims;
+    for (int i = n_batch_dims - 1; i >= 0; --i) {
+        int ai = i - (n_batch_dims - a_batch_dims);
+        int bi = i - (n_batch_dims - b_batch_dims);
+        int da = ai >= 0 ? a->shape[ai] : 1;
+        int db = bi >= 0 ? b->shape[bi] : 1;
+        if (da != db && da != 1 && db != 1) {
+            fprintf(stderr, "Batch dimensions cannot be broadcast for multiplication.\n");
+            return -1;
+        }
+        out_shape[i] = da > db ? da : db;
+    }
+    out_shape[n_batch_dims] = a->shape[a->n_dims - 2];
+    out_shape[n_batch_dims + 1] = transpose_b ? b_rows : b_cols;
+    return n_batch_dims + 2;
+}
+
+// Strided-batched GEMM: out[..., M, N] = a[..., M, K] * op(b)
+// op(b) is b[..., K, N], or the transpose of b[..., N, K] when transpose_b is set.
+// Leading (batch) dimensions broadcast like NumPy: they are aligned from the right
+// and a dimension of 1 (or a missing one) is shared by every index of the other
+// operand. Each batch element is an independent GEMM; b is packed straight from
+// its strides, so a transposed or broadcast operand is never copied first.
+static int bmm_strided(Tensor* out, const Tensor* a, const Tensor* b, int transpose_b) {
+    int out_shape[(a->n_dims > b->n_dims ? a->n_dims : b->n_dims) + 2];
+    int out_dims = bmm_output_shape(a, b, transpose_b, out_shape);
+    if (out_dims < 0) {
+        return -1;
+    }
+    int M = a->shape[a->n_dims - 2];
+    int K = a->shape[a->n_dims - 1];
+    int b_rows = b->shape[b->n_dims - 2];
+    int b_cols = b->shape[b->n_dims - 1];
+    int N = out_shape[out_dims - 1];
+
+    // Each operand's element stride per broadcast batch dimension (0 where it is shared)
+    int a_batch_dims = a->n_dims - 2;
+    int b_batch_dims = b->n_dims - 2;
+    int n_batch_dims = out_dims - 2;
+    long a_strides[n_batch_dims + 1];
+    long b_strides[n_batch_dims + 1];
+    long a_step = (long)M * K;
+    long b_step = (long)b_rows * b_cols;
+    for (int i = n_batch_dims - 1; i >= 0; --i) {
+        int ai = i - (n_batch_dims - a_batch_dims);
+        int bi = i - (n_batch_dims - b_batch_dims);
+        int da = ai >= 0 ? a->shape[ai] : 1;
+        int db = bi >= 0 ? b->shape[bi] : 1;
+        a_strides[i] = (da == 1) ? 0 : a_step;
+        b_strides[i] = (db == 1) ? 0 : b_step;
+        a_step *= da;
+        b_step *= db;
+    }
+    resize_tensor(out, out_shape, out_dims);
+
+    int n_batch = out->size / ((M * N) > 0 ? M * N : 1);
+    PackedMatrix packed;
+    packed.k = K;
+    packed.n = N;
+    packed.data = thread_buffer(&bmm_pack_buffer, (size_t)((N + GEMM_NR - 1) / GEMM_NR) * K * GEMM_NR);
+    if (!packed.data) {
+        fprintf(stderr, "Failed to allocate the batched GEMM packing buffer.\n");
+        return -1;
+    }
+    long b_rs = transpose_b ? 1 : b_cols;
+    long b_cs = transpose_b ? b_cols : 1;
+
+    long packed_offset = -1;
+    for (int batch = 0; batch < n_batch; ++batch) {
+        long a_offset = 0, b_offset = 0;
+        int rem = batch;
+        for (int i = n_batch_dims - 1; i >= 0; --i) {
+            int idx = rem % out_shape[i];
+            rem /= out_shape[i];
+            a_offset += idx * a_strides[i];
+            b_offset += idx * b_strides[i];
+        }
+        // A broadcast b is packed once for every batch that shares it
+        if (b_offset != packed_offset) {
+            pack_panels(packed.data, b->data + b_offset, K, N, b_rs, b_cs);
+            packed_offset = b_offset;
+        }
+        gemm_packed(a->data + a_offset, M, &packed, out->data + (size_t)batch * M * N);
+    }
+    return 0;
+}
+
+// Function for batched matrix multiplication with broadcast over leading dimensions, into out
+int bmm_into(Tensor* out, const Tensor* a, const Tensor* b) {
+    return bmm_strided(out, a, b, 0);
+}
+
+// Function to compute a[..., M, K] times the transpose of b[..., N, K], into out
+int bmm_transposed_into(Tensor* out, const Tensor* a, const Tensor* b) {
+    return bmm_strided(out, a, b, 1);
+}
+
+// Function for batched matrix multiplication with broadcast over leading dimensions
+Tensor* bmm(const Tensor* a, const Tensor* b) {
+    int out_shape[(a->n_dims > b->n_dims ? a->n_dims : b->n_dims) + 2];
+    int out_dims = bmm_output_shape(a, b, 0, out_shape);
+    if (out_dims < 0) {
+        return NULL;
+    }
+    Tensor* result = create_tensor(out_shape, out_dims);
+    if (bmm_into(result, a, b) != 0) {
+        free_tensor(result);
+        return NULL;
+    }
+    return result;
+}
+
+// Function for matrix multiplication, into out
+// 2D operands are multiplied directly; anything with batch dimensions goes through bmm.
+// b is packed into a temporary panel copy; use matmul_packed_into with a kept
+// PackedMatrix when b is reused.
+int matmul_into(Tensor* out, const Tensor* a, const Tensor* b) {
+    if (a->n_dims != 2 || b->n_dims != 2) {
+        return bmm_into(out, a, b);
+    }
+    if (a->shape[1] != b->shape[0]) {
+        fprintf(stderr, "Matrix dimensions are not compatible for multiplication.\n");
+        return -1;
+    }
+    PackedMatrix* packed = pack_matrix(b->data, b->shape[0], b->shape[1]);
+    int rc = matmul_packed_into(out, a, packed);
+    free_packed_matrix(packed);
+    return rc;
+}
+
+// Function for matrix multiplication
 Tensor* matmul(const Tensor* a, const Tensor* b) {
-    if (a->n_dims != 2 || b->n_dims != 2) {        fprintf(stderr, "Matrix multiplication is only implemented for 2D tensors.\n");        return NULL;    }    if (a->shape[1] != b->shape[0]) {        fprintf(stderr, "Matrix dimensions are not compatible for multiplication.\n");        return NULL;    }    int new_shape[] = {a->shape[0], b->shape[1]};    Tensor* result = create_tensor(new_shape, 2);    for (int i = 0; i < a->shape[0]; ++i) {        for (int j = 0; j < b->shape[1]; ++j) {            float sum = 0.0f;            for (int k = 0; k < a->shape[1]; ++k) {                int a_indices[] = {i, k};                int b_indices[] = {k, j};                sum += get_tensor_value(a, a_indices) * get_tensor_value(b, b_indices);            }            int result_indices[] = {i, j};            set_tensor_value(result, result_indices, sum);        }    }    return result;}
+    if (a->n_dims != 2 || b->n_dims != 2) {
+        return bmm(a, b);
+    }
+    int out_shape[] = {a->shape[0], b->shape[1]};
+    Tensor* result = create_tensor(out_shape, 2);
+    if (matmul_into(result, a, b) != 0) {
+        free_tensor(result);
+        return NULL;
+    }
+    return result;
+}
 
-// Function to add two tensors
-Tensor* add(const Tensor* a, const Tensor* b) {
+// Function to add two tensors into out
+int add_into(Tensor* out, const Tensor* a, const Tensor* b) {
     if (a->size != b->size) {
         fprintf(stderr, "Tensors must have the same size for addition\n");
-        return NULL;
+        return -1;
+    }
+    if (out != a) {
+        resize_tensor(out, a->shape, a->n_dims);
     }
+    get_kernels()->vec_add(out->data, a->data, b->data, a->size);
+    return 0;
+}
+
+// Function to add two tensors
+Tensor* add(const Tensor* a, const Tensor* b) {
     Tensor* result = create_tensor(a->shape, a->n_dims);
-    for (int i = 0; i < a->size; ++i) {
-        result->data[i] = a->data[i] + b->data[i];
+    if (add_into(result, a, b) != 0) {
+        free_tensor(result);
+        return NULL;
     }
     return result;
 }
 
+// Function to add b to a in place
+void add_(Tensor* a, const Tensor* b) {
+    add_into(a, a, b);
+}
+
+// Function to apply ReLU in place
+void relu_(Tensor* tensor) {
+    row_relu(tensor->data, tensor->size);
+}
+
 // Function to apply softmax to a tensor
 // Function to apply softmax to a tensor along a specific dimension
 void softmax(Tensor* tensor, int dim) {
@@ -111,85 +513,100 @@ void softmax(Tensor* tensor, int dim) {
     int inner_size = tensor->shape[dim];
 
     for (int i = 0; i < outer_size; ++i) {
-        float max_val = -INFINITY;
-        int offset = i * inner_size;
-
-        for (int j = 0; j < inner_size; ++j) {
-            if (tensor->data[offset + j] > max_val) {
-                max_val = tensor->data[offset + j];
-            }
-        }
+        row_softmax(tensor->data + (size_t)i * inner_size, inner_size);
+    }
+}
 
-        float sum = 0.0f;
-        for (int j = 0; j < inner_size; ++j) {
-            tensor->data[offset + j] = expf(tensor->data[offset + j] - max_val);
-            sum += tensor->data[offset + j];
-        }
+// Function to swap the last two dimensions of a tensor into out
+int transpose_into(Tensor* out, const Tensor* a) {
+    if (a->n_dims < 2) {
+        fprintf(stderr, "Transpose needs at least a 2D tensor.\n");
+        return -1;
+    }
+    int rows = a->shape[a->n_dims - 2];
+    int cols = a->shape[a->n_dims - 1];
+    int new_shape[a->n_dims];
+    memcpy(new_shape, a->shape, a->n_dims * sizeof(int));
+    new_shape[a->n_dims - 2] = cols;
+    new_shape[a->n_dims - 1] = rows;
+    resize_tensor(out, new_shape, a->n_dims);
 
-        for (int j = 0; j < inner_size; ++j) {
-            tensor->data[offset + j] /= sum;
+    size_t matrix = (size_t)rows * cols;
+    int n_batch = matrix > 0 ? a->size / matrix : 0;
+    for (int batch = 0; batch < n_batch; ++batch) {
+        const float* src = a->data + batch * matrix;
+        float* dst = out->data + batch * matrix;
+        for (int i = 0; i < rows; ++i) {
+            for (int j = 0; j < cols; ++j) {
+                dst[(size_t)j * rows + i] = src[(size_t)i * cols + j];
+            }
         }
     }
+    return 0;
 }
 
-// Function to transpose a 2D tensor
+// Function to swap the last two dimensions of a tensor
 Tensor* transpose(const Tensor* a) {
-    if (a->n_dims != 2) {
-        fprintf(stderr, "Transpose is only implemented for 2D tensors.\n");
+    Tensor* result = create_tensor(a->shape, a->n_dims);
+    if (transpose_into(result, a) != 0) {
+        free_tensor(result);
         return NULL;
     }
-    int new_shape[] = {a->shape[1], a->shape[0]};
-    Tensor* result = create_tensor(new_shape, 2);
-    for (int i = 0; i < a->shape[0]; ++i) {
-        for (int j = 0; j < a->shape[1]; ++j) {
-            int old_indices[] = {i, j};
-            int new_indices[] = {j, i};
-            set_tensor_value(result, new_indices, get_tensor_value(a, old_indices));
-        }
-    }
     return result;
 }
 
-// Function to scale a tensor by a scalar value
+// Function to scale a tensor by a scalar value in place
+void scale_(Tensor* tensor, float scalar) {
+    get_kernels()->vec_scale(tensor->data, scalar, tensor->size);
+}
+
+// Function to scale a tensor by a scalar value (in place, same as scale_)
 void scale(Tensor* tensor, float scalar) {
-    for (int i = 0; i < tensor->size; ++i) {
-        tensor->data[i] *= scalar;
-    }
+    scale_(tensor, scalar);
 }
 
-// Function to concatenate tensors along a specific dimension
-Tensor* concatenate(const Tensor** tensors, int n_tensors, int dim) {
-    // For simplicity, this implementation will concatenate along the last dimension
-    if (dim != tensors[0]->n_dims - 1) {
+// Function to concatenate tensors along the last dimension into out
+int concatenate_into(Tensor* out, const Tensor** tensors, int n_tensors, int dim) {
+    int n_dims = tensors[0]->n_dims;
+    if (dim != n_dims - 1) {
         fprintf(stderr, "Concatenation is only implemented for the last dimension.\n");
-        return NULL;
+        return -1;
     }
 
     int new_dim_size = 0;
     for (int i = 0; i < n_tensors; ++i) {
+        if (tensors[i]->n_dims != n_dims || tensors[i]->size / tensors[i]->shape[dim] != tensors[0]->size / tensors[0]->shape[dim]) {
+            fprintf(stderr, "Tensors must have matching leading dimensions for concatenation.\n");
+            return -1;
+        }
         new_dim_size += tensors[i]->shape[dim];
     }
 
-    int new_shape[tensors[0]->n_dims];
-    memcpy(new_shape, tensors[0]->shape, tensors[0]->n_dims * sizeof(int));
+    int new_shape[n_dims];
+    memcpy(new_shape, tensors[0]->shape, n_dims * sizeof(int));
     new_shape[dim] = new_dim_size;
+    resize_tensor(out, new_shape, n_dims);
 
-    Tensor* result = create_tensor(new_shape, tensors[0]->n_dims);
-
+    // Every leading index is one row; each input contributes a contiguous slice of it
+    int rows = out->size / new_dim_size;
     int offset = 0;
     for (int i = 0; i < n_tensors; ++i) {
-        // This is a simplified copy and assumes a 3D tensor (B, T, C)
-        for (int b = 0; b < tensors[i]->shape[0]; ++b) {
-            for (int t = 0; t < tensors[i]->shape[1]; ++t) {
-                for (int c = 0; c < tensors[i]->shape[2]; ++c) {
-                    int src_indices[] = {b, t, c};
-                    int dest_indices[] = {b, t, offset + c};
-                    set_tensor_value(result, dest_indices, get_tensor_value(tensors[i], src_indices));
-                }
-            }
+        int width = tensors[i]->shape[dim];
+        for (int r = 0; r < rows; ++r) {
+            memcpy(out->data + (size_t)r * new_dim_size + offset, tensors[i]->data + (size_t)r * width,
+                   width * sizeof(float));
         }
-        offset += tensors[i]->shape[dim];
+        offset += width;
     }
+    return 0;
+}
 
+// Function to concatenate tensors along a specific dimension
+Tensor* concatenate(const Tensor** tensors, int n_tensors, int dim) {
+    Tensor* result = create_tensor(tensors[0]->shape, tensors[0]->n_dims);
+    if (concatenate_into(result, tensors, n_tensors, dim) != 0) {
+        free_tensor(result);
+        return NULL;
+    }
     return result;
 }
@@ -2,6 +2,7 @@
 #define TENSOR_H
 
 #include <stdlib.h>
+#include <stdint.h>
 
 // A basic Tensor structure
 typedef struct {
@@ -9,11 +10,37 @@ typedef struct {
     int* shape;     // Array representing the dimensions of the tensor
     int n_dims;     // Number of dimensions
     int size;       // Total number of elements
+    int capacity;   // Number of elements data can hold (>= size)
 } Tensor;
 
+// Column panel width of packed GEMM operands (rows per micro-kernel call are
+// chosen per instruction-set tier, see kernels_impl.h)
+#define GEMM_NR 16
+
+// A right-hand GEMM operand packed into GEMM_NR-wide column panels
+typedef struct {
+    float* data; // ceil(n / GEMM_NR) panels of k x GEMM_NR floats
+    int k;       // Rows of the original matrix
+    int n;       // Columns of the original matrix
+} PackedMatrix;
+
+// A right-hand GEMM operand with 2:4 structured sparsity: in every column, each
+// group of 4 consecutive rows holds at most 2 nonzeros, stored as values plus
+// their 2-bit positions within the group (about 53% of the dense bytes). Like
+// PackedMatrix, columns are interleaved in GEMM_NR-wide panels (the last one
+// zero-padded), so one vector load covers kept value j of adjacent columns.
+typedef struct {
+    float* values;    // Per panel, k / 2 rows of GEMM_NR kept values
+    uint8_t* indices; // Per panel, k / 8 rows of GEMM_NR bytes: the group positions of 4 kept values, low bits first
+    int k;            // Rows of the original matrix (a multiple of 8)
+    int n;            // Columns of the original matrix
+} SparseMatrix;
+
 // Function prototypes for tensor operations
 Tensor* create_tensor(const int* shape, int n_dims);
 void free_tensor(Tensor* tensor);
+Tensor* resize_tensor(Tensor* tensor, const int* shape, int n_dims);
+Tensor tensor_view(float* data, int* shape, int n_dims);
 float get_tensor_value(const Tensor* tensor, const int* indices);
 void set_tensor_value(Tensor* tensor, const int* indices, float value);
 void print_tensor(const Tensor* tensor);
@@ -21,10 +48,36 @@ float rand_float();
 
 // Mathematical operations
 Tensor* matmul(const Tensor* a, const Tensor* b);
+PackedMatrix* pack_matrix(const float* b, int k, int n);
+void free_packed_matrix(PackedMatrix* packed);
+void gemm_packed(const float* a, int m, const PackedMatrix* b, float* c);
+SparseMatrix* compress_2_4(float* b, int k, int n);
+void free_sparse_matrix(SparseMatrix* sparse);
+size_t sparse_matrix_bytes(const SparseMatrix* sparse);
+void gemm_sparse(const float* a, int m, const SparseMatrix* b, float* c);
+Tensor* matmul_packed(const Tensor* a, const PackedMatrix* b);
+Tensor* bmm(const Tensor* a, const Tensor* b);
 Tensor* add(const Tensor* a, const Tensor* b);
 void softmax(Tensor* tensor, int dim);
 Tensor* transpose(const Tensor* a);
 void scale(Tensor* tensor, float scalar);
 Tensor* concatenate(const Tensor** tensors, int n_tensors, int dim);
 
+// Destination-passing forms: the result is written to out, which is reshaped to
+// the result shape and only reallocated when its capacity is too small. out must
+// not alias an input unless noted. They return 0 on success and -1 on error.
+int matmul_into(Tensor* out, const Tensor* a, const Tensor* b);
+int matmul_packed_into(Tensor* out, const Tensor* a, const PackedMatrix* b);
+int matmul_sparse_into(Tensor* out, const Tensor* a, const SparseMatrix* b);
+int bmm_into(Tensor* out, const Tensor* a, const Tensor* b);
+int bmm_transposed_into(Tensor* out, const Tensor* a, const Tensor* b);
+int add_into(Tensor* out, const Tensor* a, const Tensor* b); // out may alias a or b
+int transpose_into(Tensor* out, const Tensor* a);
+int concatenate_into(Tensor* out, const Tensor** tensors, int n_tensors, int dim);
+
+// In-place forms
+void add_(Tensor* a, const Tensor* b);
+void relu_(Tensor* tensor);
+void scale_(Tensor* tensor, float scalar);
+
 #endif // TENSOR_H
@@ -0,0 +1,271 @@
+#include "threads.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Number of worker threads, decided once on first use
+static pthread_once_t num_threads_once = PTHREAD_ONCE_INIT;
+static int num_threads = 1;
+
+// Shared state for one parallel_for call
+typedef struct {
+    ParallelTask fn;
+    void* ctx;
+    int n_tasks;
+    atomic_int next_task;
+} ParallelJob;
+
+// Persistent helpers of one thread that calls parallel_for
+// Helpers are started on first use, inherit their owner's CPU affinity, sleep on
+// a condition variable between jobs and exit together with their owner.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;       // Helpers wait here for a new job
+    pthread_cond_t done;       // The owner waits here for helpers to leave the job
+    pthread_t* threads;
+    int n_threads;             // Helpers started
+    ParallelJob* job;          // Current job, NULL between jobs
+    unsigned long generation;  // Incremented for every job
+    int n_wanted;              // Helpers the current job may still take on
+    int n_active;              // Helpers running tasks of the current job
+    int shutdown;
+} WorkerPool;
+
+// Set while this thread is running parallel_for tasks
+static __thread int parallel_depth = 0;
+
+// Most threads parallel work started on this thread may use, 0 means no limit
+static __thread int thread_budget = 0;
+
+// The calling thread's helpers, NULL until it first runs parallel work
+static __thread WorkerPool* thread_pool = NULL;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+
+// Function to pick the default thread count: the number of online cores,
+// overridable with GPTC_NUM_THREADS
+static void init_num_threads(void) {
+    const char* env = getenv("GPTC_NUM_THREADS");
+    int n = env ? atoi(env) : 0;
+    if (n <= 0) {
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    num_threads = (n > 0) ? n : 1;
+}
+
+// Function to get the number of threads used by parallel_for
+int get_num_threads(void) {
+    pthread_once(&num_threads_once, init_num_threads);
+    return num_threads;
+}
+
+// Function to override the number of threads used by parallel_for
+// Call it before starting parallel work; the default is resolved first so it
+// cannot overwrite the override later.
+void set_num_threads(int n_threads) {
+    pthread_once(&num_threads_once, init_num_threads);
+    num_threads = (n_threads > 0) ? n_threads : 1;
+}
+
+// Function to run tasks of a job until none are left
+static void run_tasks(ParallelJob* job) {
+    parallel_depth++;
+    for (;;) {
+        int task = atomic_fetch_add(&job->next_task, 1);
+        if (task >= job->n_tasks) {
+            break;
+        }
+        job->fn(task, job->ctx);
+    }
+    parallel_depth--;
+}
+
+// Helper loop: join each new job while it still wants helpers, then sleep again
+static void* pool_worker(void* arg) {
+    WorkerPool* pool = (WorkerPool*)arg;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->generation;
+        if (pool->n_wanted <= 0) {
+            continue;
+        }
+        pool->n_wanted--;
+        pool->n_active++;
+        ParallelJob* job = pool->job;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_tasks(job);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->n_active == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Function to stop and join a pool's helpers; runs when its owner thread exits
+static void free_worker_pool(void* arg) {
+    WorkerPool* pool = (WorkerPool*)arg;
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->n_threads; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
+
+static void create_pool_key(void) {
+    pthread_key_create(&pool_key, free_worker_pool);
+}
+
+// Function to get the calling thread's pool with at least n_helpers helpers
+// Returns NULL if the pool cannot be created; it may have fewer helpers than asked
+// for if thread creation fails.
+static WorkerPool* get_worker_pool(int n_helpers) {
+    WorkerPool* pool = thread_pool;
+    if (!pool) {
+        pthread_once(&pool_key_once, create_pool_key);
+        pool = (WorkerPool*)calloc(1, sizeof(WorkerPool));
+        if (!pool) {
+            return NULL;
+        }
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->wake, NULL);
+        pthread_cond_init(&pool->done, NULL);
+        thread_pool = pool;
+        pthread_setspecific(pool_key, pool);
+    }
+    if (pool->n_threads < n_helpers) {
+        pthread_t* threads = (pthread_t*)realloc(pool->threads, n_helpers * sizeof(pthread_t));
+        if (threads) {
+            pool->threads = threads;
+            // New helpers only see jobs posted after they start
+            while (pool->n_threads < n_helpers &&
+                   pthread_create(&pool->threads[pool->n_threads], NULL, pool_worker, pool) == 0) {
+                pool->n_threads++;
+            }
+        }
+    }
+    return pool;
+}
+
+// Function to run fn(task, ctx) for every task in [0, n_tasks) across all threads
+// Tasks may run in any order; callers that need a deterministic result should
+// write per-task outputs and reduce them afterwards in task order. The calling
+// thread works too, helped by up to get_thread_budget() - 1 of its pool's threads.
+void parallel_for(int n_tasks, ParallelTask fn, void* ctx) {
+    if (n_tasks <= 0) {
+        return;
+    }
+
+    ParallelJob job;
+    job.fn = fn;
+    job.ctx = ctx;
+    job.n_tasks = n_tasks;
+    atomic_init(&job.next_task, 0);
+
+    int n_workers = get_thread_budget();
+    if (n_workers > n_tasks) {
+        n_workers = n_tasks;
+    }
+    WorkerPool* pool = (n_workers > 1) ? get_worker_pool(n_workers - 1) : NULL;
+    if (!pool || pool->n_threads == 0) {
+        run_tasks(&job);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = &job;
+    pool->n_wanted = (n_workers - 1 < pool->n_threads) ? n_workers - 1 : pool->n_threads;
+    pool->n_active = 0;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tasks(&job);
+
+    // Every task has been claimed; close the job to late helpers and wait for the rest
+    pthread_mutex_lock(&pool->lock);
+    pool->n_wanted = 0;
+    while (pool->n_active > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pool->job = NULL;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Function to check whether the caller is already inside a parallel_for task
+// Lets nested code run serially instead of oversubscribing the cores.
+int in_parallel_region(void) {
+    return parallel_depth > 0;
+}
+
+// Function to get the number of threads parallel work started on this thread may use
+// 1 inside a parallel_for task, else get_num_threads() capped by set_thread_budget.
+int get_thread_budget(void) {
+    if (in_parallel_region()) {
+        return 1;
+    }
+    int n = get_num_threads();
+    return (thread_budget > 0 && thread_budget < n) ? thread_budget : n;
+}
+
+// Function to cap the threads of parallel work started on the calling thread
+// For threads that share the cores with others running concurrently (server
+// sessions, pipeline stages); 0 removes the cap.
+void set_thread_budget(int n_threads) {
+    thread_budget = (n_threads > 0) ? n_threads : 0;
+}
+
+// Function to get a monotonic wall-clock time in seconds
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Bytes in front of a thread buffer's floats: its capacity, padded to a cache line
+#define THREAD_BUFFER_HEADER 64
+
+static pthread_mutex_t thread_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Function to get the calling thread's buffer of at least n_floats floats
+// The contents are whatever this thread last left there.
+float* thread_buffer(ThreadBuffer* tb, size_t n_floats) {
+    if (!atomic_load_explicit(&tb->ready, memory_order_acquire)) {
+        pthread_mutex_lock(&thread_buffer_lock);
+        if (!atomic_load_explicit(&tb->ready, memory_order_relaxed)) {
+            pthread_key_create(&tb->key, free);
+            atomic_store_explicit(&tb->ready, 1, memory_order_release);
+        }
+        pthread_mutex_unlock(&thread_buffer_lock);
+    }
+    char* block = (char*)pthread_getspecific(tb->key);
+    if (!block || *(size_t*)block < n_floats) {
+        free(block);
+        if (posix_memalign((void**)&block, THREAD_BUFFER_HEADER, THREAD_BUFFER_HEADER + n_floats * sizeof(float)) != 0) {
+            pthread_setspecific(tb->key, NULL);
+            return NULL;
+        }
+        *(size_t*)block = n_floats;
+        pthread_setspecific(tb->key, block);
+    }
+    return (float*)(block + THREAD_BUFFER_HEADER);
+}
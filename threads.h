@@ -0,0 +1,30 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Signature of a unit of parallel work: called once per task index
+typedef void (*ParallelTask)(int task, void* ctx);
+
+// A growing scratch buffer private to each thread, freed when the thread exits
+// Each use site keeps one as a static initialised with THREAD_BUFFER_INIT.
+typedef struct {
+    atomic_int ready; // key has been created
+    pthread_key_t key;
+} ThreadBuffer;
+
+#define THREAD_BUFFER_INIT {0}
+
+// Function prototypes
+int get_num_threads(void);
+void set_num_threads(int n_threads);
+void parallel_for(int n_tasks, ParallelTask fn, void* ctx);
+int in_parallel_region(void);
+int get_thread_budget(void);
+void set_thread_budget(int n_threads);
+double now_seconds(void);
+float* thread_buffer(ThreadBuffer* tb, size_t n_floats);
+
+#endif // THREADS_H
@@ -0,0 +1,142 @@
+#include "vmath.h"
+#include "kernels.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Current mode, read from GPTC_MATH once on first use
+static pthread_once_t vmath_mode_once = PTHREAD_ONCE_INIT;
+static VMathMode vmath_mode = VMATH_FAST;
+
+// Function to apply GPTC_MATH=strict
+static void init_vmath_mode(void) {
+    const char* env = getenv("GPTC_MATH");
+    vmath_mode = (env && strcmp(env, "strict") == 0) ? VMATH_STRICT : VMATH_FAST;
+}
+
+// Function to get the current math mode
+VMathMode vmath_get_mode(void) {
+    pthread_once(&vmath_mode_once, init_vmath_mode);
+    return vmath_mode;
+}
+
+// Function to select fast or strict math
+// Call it before starting parallel work; the environment default is resolved
+// first so it cannot overwrite the choice later.
+void vmath_set_mode(VMathMode mode) {
+    pthread_once(&vmath_mode_once, init_vmath_mode);
+    vmath_mode = mode;
+}
+
+// Scalar reference versions used in strict mode
+static inline float rsqrt_ref(float x) {
+    return 1.0f / sqrtf(x);
+}
+
+static inline float gelu_ref(float x) {
+    return 0.5f * x * (1.0f + tanhf(0.7978845608028654f * (x + 0.044715f * x * x * x)));
+}
+
+// Elementwise entry points: scalar libm in strict mode, the dispatched kernel otherwise
+#define VMATH_MAP(NAME, REF)                                          \
+    void NAME(float* y, const float* x, int n) {                      \
+        if (vmath_get_mode() == VMATH_STRICT) {                       \
+            for (int i = 0; i < n; ++i) {                             \
+                y[i] = REF(x[i]);                                     \
+            }                                                         \
+            return;                                                   \
+        }                                                             \
+        get_kernels()->NAME(y, x, n);                                 \
+    }
+
+VMATH_MAP(vec_exp, expf)
+VMATH_MAP(vec_log, logf)
+VMATH_MAP(vec_rsqrt, rsqrt_ref)
+VMATH_MAP(vec_tanh, tanhf)
+VMATH_MAP(vec_gelu, gelu_ref)
+
+// Function to get the maximum of a row
+float row_max(const float* x, int n) {
+    return get_kernels()->row_max(x, n);
+}
+
+// Function to compute sum_i exp(x[i] - shift) without writing the exponentials
+float row_sum_exp(const float* x, int n, float shift) {
+    if (vmath_get_mode() == VMATH_STRICT) {
+        float sum = 0.0f;
+        for (int i = 0; i < n; ++i) {
+            sum += expf(x[i] - shift);
+        }
+        return sum;
+    }
+    return get_kernels()->row_sum_exp(x, n, shift);
+}
+
+// Function to replace a row by exp(x[i] - shift)
+void row_exp_shift(float* x, int n, float shift) {
+    if (vmath_get_mode() == VMATH_STRICT) {
+        for (int i = 0; i < n; ++i) {
+            x[i] = expf(x[i] - shift);
+        }
+        return;
+    }
+    get_kernels()->row_exp_shift(x, n, shift);
+}
+
+// Function to apply a numerically stable softmax to one row in place
+void row_softmax(float* x, int n) {
+    if (vmath_get_mode() == VMATH_STRICT) {
+        float max_val = row_max(x, n);
+        float sum = 0.0f;
+        for (int i = 0; i < n; ++i) {
+            x[i] = expf(x[i] - max_val);
+            sum += x[i];
+        }
+        for (int i = 0; i < n; ++i) {
+            x[i] /= sum;
+        }
+        return;
+    }
+    get_kernels()->row_softmax(x, n);
+}
+
+// Function to compute log(sum_i exp(x[i])) of one row
+float row_logsumexp(const float* x, int n) {
+    float max_val = row_max(x, n);
+    return max_val + logf(row_sum_exp(x, n, max_val));
+}
+
+// Function to layer-normalize one row: y = (x - mean) / sqrt(var + eps) * gamma + beta
+void row_layer_norm(float* y, const float* x, const float* gamma, const float* beta, int n, float epsilon) {
+    if (vmath_get_mode() != VMATH_STRICT) {
+        get_kernels()->row_layer_norm(y, x, gamma, beta, n, epsilon);
+        return;
+    }
+    float sum = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        sum += x[i];
+    }
+    float mean = sum / n;
+
+    float sum_sq = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        float d = x[i] - mean;
+        sum_sq += d * d;
+    }
+    float rstd = rsqrt_ref(sum_sq / n + epsilon);
+
+    for (int i = 0; i < n; ++i) {
+        y[i] = (x[i] - mean) * rstd * gamma[i] + beta[i];
+    }
+}
+
+// Function to apply ReLU to one row in place
+void row_relu(float* x, int n) {
+    get_kernels()->vec_relu(x, n);
+}
+
+// Function to apply GELU to one row in place
+void row_gelu(float* x, int n) {
+    vec_gelu(x, x, n);
+}
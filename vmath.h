@@ -0,0 +1,45 @@
+#ifndef VMATH_H
+#define VMATH_H
+
+// Vectorized transcendental math and fused row kernels
+//
+// Fast mode evaluates Cephes-style polynomials on GCC vector types through the
+// dispatched kernel table (kernels.h), so the width follows the CPU tier. Strict mode routes every element through the
+// scalar libm reference (expf, logf, sqrtf, tanhf). Measured max error of the fast
+// path against a double-precision reference, over the ranges used by the model:
+//   vec_exp    1 ULP   (x in [-87.3, 88.7]; below returns 0, above returns +inf)
+//   vec_log    1 ULP   (normal x > 0; 0 -> -inf, x < 0 -> NaN, denormals clamp to FLT_MIN)
+//   vec_rsqrt  3 ULP   (normal x > 0)
+//   vec_tanh   1 ULP
+//   vec_gelu   5e-7 absolute against the tanh formula in double (relative error
+//              grows where gelu(x) -> 0 for x < -2)
+// Row kernels accumulate in float in both modes.
+
+typedef enum {
+    VMATH_FAST = 0,   // SIMD polynomial approximations
+    VMATH_STRICT = 1  // Scalar libm reference path
+} VMathMode;
+
+// Function prototypes
+// The initial mode is VMATH_FAST unless GPTC_MATH=strict is set in the environment.
+VMathMode vmath_get_mode(void);
+void vmath_set_mode(VMathMode mode);
+
+// Elementwise functions over n floats; y may alias x
+void vec_exp(float* y, const float* x, int n);
+void vec_log(float* y, const float* x, int n);
+void vec_rsqrt(float* y, const float* x, int n);
+void vec_tanh(float* y, const float* x, int n);
+void vec_gelu(float* y, const float* x, int n);
+
+// Fused row kernels
+float row_max(const float* x, int n);
+float row_sum_exp(const float* x, int n, float shift);  // sum_i exp(x[i] - shift)
+void row_exp_shift(float* x, int n, float shift);       // x[i] = exp(x[i] - shift)
+void row_softmax(float* x, int n);
+float row_logsumexp(const float* x, int n);
+void row_layer_norm(float* y, const float* x, const float* gamma, const float* beta, int n, float epsilon);
+void row_relu(float* x, int n);
+void row_gelu(float* x, int n);
+
+#endif // VMATH_H
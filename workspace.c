@@ -0,0 +1,25 @@
+#include "workspace.h"
+#include <stdlib.h>
+
+// Function to create an empty workspace; buffers are allocated on first use
+Workspace* create_workspace(void) {
+    return (Workspace*)calloc(1, sizeof(Workspace));
+}
+
+// Function to free a workspace and all of its buffers
+void free_workspace(Workspace* ws) {
+    for (int i = 0; i < WS_COUNT; ++i) {
+        if (ws->slots[i]) {
+            free_tensor(ws->slots[i]);
+        }
+    }
+    free(ws);
+}
+
+// Function to get a slot shaped as a (rows, cols) matrix
+// Contents are whatever the slot last held.
+Tensor* workspace_matrix(Workspace* ws, WorkspaceSlot slot, int rows, int cols) {
+    int shape[] = {rows, cols};
+    ws->slots[slot] = resize_tensor(ws->slots[slot], shape, 2);
+    return ws->slots[slot];
+}
@@ -0,0 +1,32 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include "tensor.h"
+
+// Named intermediate buffers of one forward pass
+typedef enum {
+    WS_RESIDUAL,   // Residual stream, updated in place by every block
+    WS_LN_OUT,     // LayerNorm output feeding attention or feed-forward
+    WS_Q,          // Queries of one key/value group, and its keys and values
+    WS_K,
+    WS_V,
+    WS_ATTN_OUT,   // Concatenated head outputs
+    WS_BRANCH_OUT, // Attention / feed-forward output added to the residual
+    WS_FFN_HIDDEN, // Feed-forward hidden activations
+    WS_SCORES,     // Attention weights of one query group at one position
+    WS_COUNT
+} WorkspaceSlot;
+
+// Buffers reused across forward passes so a steady state allocates nothing
+// Each slot grows to the largest shape requested and then stays allocated. A
+// workspace belongs to one sequence at a time (KV caches own one each).
+typedef struct {
+    Tensor* slots[WS_COUNT];
+} Workspace;
+
+// Function prototypes
+Workspace* create_workspace(void);
+void free_workspace(Workspace* ws);
+Tensor* workspace_matrix(Workspace* ws, WorkspaceSlot slot, int rows, int cols);
+
+#endif // WORKSPACE_H